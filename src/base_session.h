@@ -10,6 +10,7 @@
 
 #include "packet.h"
 #include "packet_manager.h"
+#include "packet_dispatch.h"
 
 #include <event2/bufferevent.h>
 
@@ -23,7 +24,7 @@
  *
  * Each BaseSession composes a PacketManager instance that can be moved between BaseSession instances.
  */
-class BaseSession {
+class BaseSession : public PacketHandler {
 
 public:
 
@@ -41,8 +42,7 @@ public:
      * @param bev Pointer to a bufferevent.
      */
     BaseSession(struct bufferevent *bev) : packet_manager(new PacketManager(bev)) {
-        packet_manager->set_packet_received_handler(
-                std::bind(&BaseSession::packet_received, this, std::placeholders::_1));
+        packet_manager->set_packet_handler(this);
         packet_manager->set_event_handler(std::bind(&BaseSession::packet_manager_event, this, std::placeholders::_1));
     }
 
@@ -57,19 +57,19 @@ public:
     std::string client_id;
 
     /** Clean session flag. */
-    bool clean_session;
+    bool clean_session = false;
 
     /**
-     * PacketManager callback.
+     * Handle a borrowed packet.
      *
-     * Invoked by the installed PacketManager instance when it receives a complete control packet.  The default handler
-     * methods will be passed a reference to the received packet.  Packet memory is heap allocated on creation and
-     * will be freed according to standard C++ std::unique_ptr rules.  It is the responsibility of subclasses to
-     * manage the std::unique_ptr<Packet>.
+     * Adapter for packets delivered through the PacketManager packet received callback rather than the dispatch table.
+     * The packet is passed to the handler method for its type, followed by packet_dispatched, the same as a packet
+     * dispatched by the PacketManager.  Callers invoke batch_dispatched once they have passed every packet received
+     * together.
      *
-     * @param packet Pointer to a packet.
+     * @param packet Reference to a packet.
      */
-    virtual void packet_received(std::unique_ptr<Packet> packet);
+    void packet_received(const Packet &packet);
 
     /**
      * PacketManager callback.
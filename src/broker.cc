@@ -66,6 +66,21 @@ struct options_t {
     /** Port number to bind to. */
     uint16_t bind_port = 1883;
 
+    /** Maximum number of topic names held in the routing cache. */
+    size_t routing_cache_size = RoutingCache::DefaultCapacity;
+
+    /** How shared subscription messages are spread across group members. */
+    ShareStrategy share_strategy = ShareStrategy::RoundRobin;
+
+    /** Maximum size of a packet accepted from a client, zero for no limit. */
+    size_t max_packet_size = 0;
+
+    /** Maximum packet sizes of particular clients, by client id. */
+    std::unordered_map<std::string, size_t> client_max_packet_sizes;
+
+    /** Size from which published packets are streamed to subscribers, zero to never stream. */
+    size_t stream_threshold = 0;
+
 } options;
 
 int main(int argc, char *argv[]) {
@@ -79,6 +94,12 @@ int main(int argc, char *argv[]) {
 
     parse_arguments(argc, argv);
 
+    session_manager.routing_cache.set_capacity(options.routing_cache_size);
+    session_manager.share_strategy = options.share_strategy;
+    session_manager.max_packet_size = options.max_packet_size;
+    session_manager.client_max_packet_sizes = options.client_max_packet_sizes;
+    session_manager.stream_threshold = options.stream_threshold;
+
     evloop = event_base_new();
     if (!evloop) {
         std::cerr << "Could not initialize libevent\n";
@@ -105,6 +126,12 @@ int main(int argc, char *argv[]) {
 
     event_base_dispatch(evloop);
 
+    std::cout << "routing cache hits: " << session_manager.routing_cache.hits()
+              << " misses: " << session_manager.routing_cache.misses()
+              << " dropped: " << session_manager.dropped() << "\n";
+    std::cout << "subscription index nodes: " << session_manager.subscription_index.node_count()
+              << " bytes: " << session_manager.subscription_index.bytes_used() << "\n";
+
     event_free(signal_event);
     evconnlistener_free(listener);
     event_base_free(evloop);
@@ -123,20 +150,34 @@ OPTIONS
 
 --broker-host | -b        Broker host name or ip address, default localhost
 --broker-port | -p        Broker port, default 1883
+--routing-cache | -r      Number of topic names kept in the routing cache, default 4096
+--share-strategy | -s     Shared subscription delivery: round-robin, least-inflight or sticky, default round-robin
+--max-packet-size | -m    Largest packet accepted from a client in bytes, the connection is closed when a larger
+                          packet arrives, default no limit
+--client-max-packet-size | -M
+                          Largest packet accepted from one client once it has connected, given as client_id=size,
+                          this option can be provided more than once, default the --max-packet-size value
+--stream-threshold | -S   Size in bytes from which published packets are forwarded to QoS 0 subscribers as their
+                          payload arrives rather than once complete, default never
 --help | -h               Display this message and exit
 )END";
 
 }
 void parse_arguments(int argc, char *argv[]) {
     static struct option longopts[] = {
-            {"bind-addr",   required_argument, NULL, 'b'},
-            {"bind-port",   required_argument, NULL, 'p'},
-            {"help",        no_argument,       NULL, 'h'}
+            {"bind-addr",              required_argument, NULL, 'b'},
+            {"bind-port",              required_argument, NULL, 'p'},
+            {"routing-cache",          required_argument, NULL, 'r'},
+            {"share-strategy",         required_argument, NULL, 's'},
+            {"max-packet-size",        required_argument, NULL, 'm'},
+            {"client-max-packet-size", required_argument, NULL, 'M'},
+            {"stream-threshold",       required_argument, NULL, 'S'},
+            {"help",                   no_argument,       NULL, 'h'}
     };
 
 
     int ch;
-    while ((ch = getopt_long(argc, argv, "b:p:h", longopts, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "b:p:r:s:m:M:S:h", longopts, NULL)) != -1) {
         switch (ch) {
             case 'b':
                 options.bind_address = optarg;
@@ -144,6 +185,37 @@ void parse_arguments(int argc, char *argv[]) {
             case 'p':
                 options.bind_port = static_cast<uint16_t>(atoi(optarg));
                 break;
+            case 'r':
+                options.routing_cache_size = static_cast<size_t>(atol(optarg));
+                break;
+            case 's':
+                if (std::strcmp(optarg, "round-robin") == 0) {
+                    options.share_strategy = ShareStrategy::RoundRobin;
+                } else if (std::strcmp(optarg, "least-inflight") == 0) {
+                    options.share_strategy = ShareStrategy::LeastInflight;
+                } else if (std::strcmp(optarg, "sticky") == 0) {
+                    options.share_strategy = ShareStrategy::StickyTopic;
+                } else {
+                    usage();
+                    std::exit(1);
+                }
+                break;
+            case 'm':
+                options.max_packet_size = static_cast<size_t>(atol(optarg));
+                break;
+            case 'M': {
+                const char *separator = std::strrchr(optarg, '=');
+                if (!separator) {
+                    usage();
+                    std::exit(1);
+                }
+                std::string client_id(optarg, separator - optarg);
+                options.client_max_packet_sizes[client_id] = static_cast<size_t>(atol(separator + 1));
+                break;
+            }
+            case 'S':
+                options.stream_threshold = static_cast<size_t>(atol(optarg));
+                break;
             case 'h':
                 usage();
                 std::exit(0);
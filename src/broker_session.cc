@@ -14,10 +14,12 @@ bool BrokerSession::authorize_connection(const ConnectPacket &packet) {
 void BrokerSession::resume_session(std::unique_ptr<BrokerSession> &session,
                                    std::unique_ptr<PacketManager> packet_manager_ptr) {
 
+    // A publish the replaced connection was streaming can not be completed, its subscribers' streams are aborted
+    session->publish_stream.reset();
+
     packet_manager_ptr->set_event_handler(
             std::bind(&BrokerSession::packet_manager_event, session.get(), std::placeholders::_1));
-    packet_manager_ptr->set_packet_received_handler(
-            std::bind(&BrokerSession::packet_received, session.get(), std::placeholders::_1));
+    packet_manager_ptr->set_packet_handler(session.get());
     session->packet_manager = std::move(packet_manager_ptr);
 
     ConnackPacket connack;
@@ -28,18 +30,28 @@ void BrokerSession::resume_session(std::unique_ptr<BrokerSession> &session,
     session->packet_manager->send_packet(connack);
 }
 
-void BrokerSession::forward_packet(const PublishPacket &packet) {
-
-    if (packet.qos() == QoSType::QoS0) {
-        packet_manager->send_packet(packet);
-    } else if (packet.qos() == QoSType::QoS1) {
+void BrokerSession::forward_packet(const PublishPacket &packet, QoSType qos) {
+
+    if (qos == QoSType::QoS0) {
+        if (packet.qos() == QoSType::QoS0) {
+            packet_manager->send_packet(packet);
+        } else {
+            PublishPacket packet_to_send(packet);
+            packet_to_send.dup(false);
+            packet_to_send.retain(false);
+            packet_to_send.qos(QoSType::QoS0);
+            packet_manager->send_packet(packet_to_send);
+        }
+    } else if (qos == QoSType::QoS1) {
         PublishPacket packet_to_send(packet);
         packet_to_send.dup(false);
         packet_to_send.retain(false);
+        packet_to_send.qos(QoSType::QoS1);
         packet_to_send.packet_id = packet_manager->next_packet_id();
         qos1_pending_puback.push_back(packet_to_send);
+        qos1_inflight.store(qos1_pending_puback.size(), std::memory_order_relaxed);
         packet_manager->send_packet(packet_to_send);
-    } else if (packet.qos() == QoSType::QoS2) {
+    } else if (qos == QoSType::QoS2) {
 
         PublishPacket packet_to_send(packet);
         packet_to_send.dup(false);
@@ -76,8 +88,13 @@ void BrokerSession::send_pending_message() {
     return;
 }
 
-void BrokerSession::packet_received(std::unique_ptr<Packet> packet) {
-    BaseSession::packet_received(std::move(packet));
+void BrokerSession::packet_dispatched() {
+    if (expired) {
+        session_manager.erase_session(this);
+    }
+}
+
+void BrokerSession::batch_dispatched(size_t packet_count) {
     send_pending_message();
 }
 
@@ -91,10 +108,12 @@ void BrokerSession::packet_manager_event(PacketManager::EventType event) {
 void BrokerSession::handle_connect(const ConnectPacket &packet) {
 
     if (!authorize_connection(packet)) {
-        session_manager.erase_session(this);
+        expired = true;
         return;
     }
 
+    packet_manager->set_max_packet_size(session_manager.max_packet_size_for(packet.client_id));
+
     if (packet.clean_session()) {
         session_manager.erase_session(packet.client_id);
     } else {
@@ -102,7 +121,7 @@ void BrokerSession::handle_connect(const ConnectPacket &packet) {
         if (previous_session_it != session_manager.sessions.end()) {
             std::unique_ptr<BrokerSession> &previous_session_ptr = *previous_session_it;
             resume_session(previous_session_ptr, std::move(packet_manager));
-            session_manager.erase_session(this);
+            expired = true;
             return;
         }
     }
@@ -145,12 +164,54 @@ void BrokerSession::handle_publish(const PublishPacket &packet) {
 
 }
 
+bool BrokerSession::handle_publish_stream_begin(const PublishPacket &header, size_t payload_length) {
+
+    if (header.qos() == QoSType::QoS2 and
+        find(qos2_pending_pubrel.begin(), qos2_pending_pubrel.end(), header.packet_id) != qos2_pending_pubrel.end()) {
+        return false;
+    }
+
+    std::unique_ptr<PublishStream> stream(new PublishStream(session_manager, header, payload_length,
+                                                            packet_manager.get()));
+    if (!stream->streaming()) {
+        return false;
+    }
+
+    publish_stream = std::move(stream);
+    return true;
+}
+
+void BrokerSession::handle_publish_stream_data(struct evbuffer *chunk) {
+    publish_stream->write(chunk);
+}
+
+void BrokerSession::handle_publish_stream_end() {
+
+    std::unique_ptr<PublishStream> stream = std::move(publish_stream);
+    const PublishPacket &packet = stream->finish();
+
+    if (packet.qos() == QoSType::QoS1) {
+        PubackPacket puback;
+        puback.packet_id = packet.packet_id;
+        packet_manager->send_packet(puback);
+    } else if (packet.qos() == QoSType::QoS2) {
+        qos2_pending_pubrel.push_back(packet.packet_id);
+    }
+
+    send_pending_message();
+}
+
+void BrokerSession::handle_publish_stream_abort() {
+    publish_stream.reset();
+}
+
 void BrokerSession::handle_puback(const PubackPacket &packet) {
 
     auto message = find_if(qos1_pending_puback.begin(), qos1_pending_puback.end(),
                            [&packet](const PublishPacket &p) { return p.packet_id == packet.packet_id; });
     if (message != qos1_pending_puback.end()) {
         qos1_pending_puback.erase(message);
+        qos1_inflight.store(qos1_pending_puback.size(), std::memory_order_relaxed);
     }
 
 }
@@ -203,15 +264,15 @@ void BrokerSession::handle_subscribe(const SubscribePacket &packet) {
 
     for (auto subscription : packet.subscriptions) {
 
-        auto previous_subscription = find_if(subscriptions.begin(), subscriptions.end(),
-                                             [&subscription](const Subscription &s) {
-                                                 return topic_match(s.topic_filter, subscription.topic_filter);
-                                             });
-        if (previous_subscription != subscriptions.end()) {
-            subscriptions.erase(previous_subscription);
+        if (SharedFilter::is_shared(subscription.topic_filter) and !SharedFilter::is_valid(subscription.topic_filter)) {
+            suback.return_codes.push_back(SubackPacket::ReturnCode::Failure);
+            continue;
         }
 
-        subscriptions.push_back(subscription);
+        // An unchanged resubscription leaves the subscription index and routing cache alone
+        if (subscriptions.insert(subscription)) {
+            session_manager.subscribe(this, subscription);
+        }
 
         SubackPacket::ReturnCode return_code = SubackPacket::ReturnCode::Failure;
         switch (subscription.qos) {
@@ -234,6 +295,15 @@ void BrokerSession::handle_subscribe(const SubscribePacket &packet) {
 
 void BrokerSession::handle_unsubscribe(const UnsubscribePacket &packet) {
 
+    for (auto &topic : packet.topics) {
+
+        TopicFilter topic_filter(topic);
+
+        if (subscriptions.erase(topic_filter)) {
+            session_manager.unsubscribe(this, topic_filter);
+        }
+    }
+
     UnsubackPacket unsuback;
 
     unsuback.packet_id = packet.packet_id;
@@ -244,6 +314,6 @@ void BrokerSession::handle_unsubscribe(const UnsubscribePacket &packet) {
 
 void BrokerSession::handle_disconnect(const DisconnectPacket &packet) {
     if (clean_session) {
-        session_manager.erase_session(this);
+        expired = true;
     }
 }
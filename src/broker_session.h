@@ -14,11 +14,14 @@
 #include "base_session.h"
 #include "packet_manager.h"
 #include "packet.h"
+#include "subscription_set.h"
+#include "publish_stream.h"
 
 #include <event2/bufferevent.h>
 
 #include <list>
 #include <memory>
+#include <atomic>
 
 class SessionManager;
 
@@ -65,7 +68,7 @@ public:
      * id.  This method is used to perform that action once a persisted session is recognized.  This method accepts
      * a reference to the BrokerSession to be restored and PacketManager instance to be installed in the restored
      * session.  Once installed a the PacketManager will send a Connack packet to the connecting client with the
-     * Session Present flag set.
+     * Session Present flag set.  A publish being streamed from the replaced connection is abandoned.
      *
      * @param session        Reference to the session to be resumed.
      * @param packet_manager PacketManager to be installed in the resumed session.
@@ -74,39 +77,50 @@ public:
                         std::unique_ptr<PacketManager> packet_manager);
 
     /**
-     * List of topics subscribed to by this client.
+     * Set of topics subscribed to by this client.
+     *
+     * Kept in step with the SessionManager subscription index.
      */
-    std::vector<Subscription> subscriptions;
+    SubscriptionSet subscriptions;
 
     /**
      * Forward a publshed message to the connected client.
      *
      * This method is called by the SessionManager when forwarding messages to subscribed clients.  It will behave
-     * according to the QoS in the PublishPacket.  QoS 0 packets will be forwarded and forgotten.  In the case of QoS 1
-     * or 2 messages, these will be retained until they are acknowledged according to the publish control packet
-     * protocol flow described in the MQTT 3.1.1 standard.
+     * according to the delivery QoS, which may be lower than the QoS in the PublishPacket.  QoS 0 packets will be
+     * forwarded and forgotten.  In the case of QoS 1 or 2 messages, these will be retained until they are acknowledged
+     * according to the publish control packet protocol flow described in the MQTT 3.1.1 standard.  Retained packets
+     * share the published Message, only their header flags and packet id belong to this session.
      *
      * @param packet Reference to the PublishPacket to forward.
+     * @param qos    Delivery QoS, the lower of the published QoS and the QoS granted to the matching subscription.
      */
-    void forward_packet(const PublishPacket &packet);
+    void forward_packet(const PublishPacket &packet, QoSType qos);
 
     /**
      * Send messages from the pending queues.
      *
      * Iterate through the pending message queues and if non-empty send a single pending message.  This method should
-     * be called periodically.  Currently it is called each time a packet is received from a client.
+     * be called periodically.  Currently it is called once for each batch of packets received from a client.
      */
     void send_pending_message(void);
 
     /**
-     * PacketManager callback.
+     * PacketHandler callback.
      *
-     * This method will delegate to the BaseSession method and then invoke send_pending_message.  Ownership of the
-     * Packet is transfered back to the BaseSession instance.
+     * Invoked once the handler method for a received packet returns.  If the handler has expired this session it is
+     * removed from the SessionManager.
+     */
+    void packet_dispatched() override;
+
+    /**
+     * PacketHandler callback.
      *
-     * @param packet Reference counted pointer to a packet.
+     * Invoked once every packet received in one read has been dispatched.  Invokes send_pending_message.
+     *
+     * @param packet_count Number of packets in the batch.
      */
-    void packet_received(std::unique_ptr<Packet> packet) override;
+    void batch_dispatched(size_t packet_count) override;
 
     /**
      * PacketManager callback.
@@ -144,6 +158,39 @@ public:
      */
     void handle_publish(const PublishPacket & publish_packet) override;
 
+    /**
+     * Offered a publish whose payload can be streamed.
+     *
+     * Accepts the stream if some subscriber delivery can be streamed, see PublishStream.  A QoS 2 publish whose packet
+     * id is waiting for Pubrel is a retransmission and is declined, handle_publish then discards it as usual.
+     *
+     * @param header         Reference to the publish, its message holds the topic name and an empty payload.
+     * @param payload_length Length of the payload to follow.
+     * @return               The payload is streamed.
+     */
+    bool handle_publish_stream_begin(const PublishPacket & header, size_t payload_length) override;
+
+    /**
+     * Forward the next part of a streamed payload.
+     *
+     * @param chunk Pointer to a buffer holding the part.
+     */
+    void handle_publish_stream_data(struct evbuffer *chunk) override;
+
+    /**
+     * Complete a streamed publish.
+     *
+     * The store and forward deliveries are made and the publisher is acknowledged as for handle_publish.
+     */
+    void handle_publish_stream_end() override;
+
+    /**
+     * Abandon a streamed publish.
+     *
+     * The message is discarded unacknowledged and the connections it was streamed to are failed.
+     */
+    void handle_publish_stream_abort() override;
+
     /**
      * Handle a received PubackPacket.
      *
@@ -193,8 +240,10 @@ public:
     /**
      * Handle a received SubscribePacket.
      *
-     * Add the contained topic names to the list of subscriptions maintained in this session.  Any previous matching
-     * subscribed topic will be replaced by the new one overriding the subscribed QoS.  Send a Suback packet in
+     * Add the contained topic names to the set of subscriptions maintained in this session and to the
+     * SessionManager subscription index.  Any previous matching subscribed topic will be replaced by the new one
+     * overriding the subscribed QoS.  Topic filters of the form $share/<group>/<filter> join the session to a shared
+     * subscription group, a failure return code is sent for a malformed shared filter.  Send a Suback packet in
      * response.
      *
      * @param subscribe_packet A reference to the packet.
@@ -204,9 +253,8 @@ public:
     /**
      * Handle a received UnsubscribePacket.
      *
-     * Remove the topic name from the list of subscribed topics.
-     *
-     * //TODO This function is currently incomplete.
+     * Remove the topic names from the set of subscribed topics and from the SessionManager subscription index.  Send an
+     * Unsuback packet in response.
      *
      * @param unsubscribe_packet A reference to the packet.
      */
@@ -230,6 +278,14 @@ public:
     */
     std::vector<PublishPacket> qos1_pending_puback;
 
+    /**
+     * Number of QoS 1 messages waiting for Puback.
+     *
+     * Kept in step with qos1_pending_puback.  Shared subscription groups read it to choose the least loaded member,
+     * possibly on reader threads of a ConcurrentSubscriptionIndex while this session changes the list.
+     */
+    std::atomic<size_t> qos1_inflight{0};
+
     /**
      * List of QoS 2 messages waiting for Pubrec.
      *
@@ -262,5 +318,16 @@ public:
      */
     SessionManager &session_manager;
 
+    /**
+     * Session should be removed from the SessionManager.
+     *
+     * Handlers cannot erase their own session while it is dispatching a packet.  They set this flag instead and the
+     * session is erased by packet_dispatched after the handler returns.
+     */
+    bool expired = false;
+
+    /** Publish being received from the client and forwarded as it arrives, nullptr when none is. */
+    std::unique_ptr<PublishStream> publish_stream;
+
 };
 
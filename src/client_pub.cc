@@ -140,10 +140,10 @@ public:
 
         PublishPacket publish_packet;
         publish_packet.qos(options.qos);
-        publish_packet.topic_name = options.topic;
+        publish_packet.message = std::make_shared<Message>(
+                options.topic, std::vector<uint8_t>(options.message.begin(), options.message.end()));
         publish_packet.packet_id = packet_manager->next_packet_id();
         published_packet_id = publish_packet.packet_id;
-        publish_packet.message_data = std::vector<uint8_t>(options.message.begin(), options.message.end());
         packet_manager->send_packet(publish_packet);
 
         if (options.qos == QoSType::QoS0) {
@@ -101,6 +101,9 @@ struct options_t {
      */
     bool clean_session = false;
 
+    /** Maximum size of a packet received from the broker, zero for no limit. */
+    size_t max_packet_size = 0;
+
 } options;
 
 /**
@@ -178,7 +181,7 @@ public:
      */
     void handle_publish(const PublishPacket &publish_packet) override {
 
-        std::cout << std::string(publish_packet.message_data.begin(), publish_packet.message_data.end()) << "\n";
+        std::cout << std::string(publish_packet.message_data().begin(), publish_packet.message_data().end()) << "\n";
 
         if (publish_packet.qos() == QoSType::QoS1) {
             PubackPacket puback_packet;
@@ -268,6 +271,7 @@ static void connect_event_cb(struct bufferevent *bev, short events, void *arg) {
     if (events & BEV_EVENT_CONNECTED) {
 
         session = std::unique_ptr<ClientSession>(new ClientSession(bev, options));
+        session->packet_manager->set_max_packet_size(options.max_packet_size);
 
         ConnectPacket connect_packet;
         connect_packet.client_id = options.client_id;
@@ -303,6 +307,8 @@ OPTIONS
                           to multiple topics, default none
 --qos | -q                QoS (Quality of Service), should be 0, 1, or 2, default 0
 --clean-session | -c      Disable session persistence, default false
+--max-packet-size | -m    Largest packet accepted from the broker in bytes, the connection is closed when a larger
+                          packet arrives, default no limit
 --help | -h               Display this message and exit
 )END";
 
@@ -310,18 +316,19 @@ OPTIONS
 
 void parse_arguments(int argc, char *argv[]) {
     static struct option longopts[] = {
-            {"broker-host",   required_argument, NULL, 'b'},
-            {"broker-port",   required_argument, NULL, 'p'},
-            {"client-id",     required_argument, NULL, 'i'},
-            {"topic",         required_argument, NULL, 't'},
-            {"qos",           required_argument, NULL, 'q'},
-            {"clean-session", no_argument,       NULL, 'c'},
-            {"help",          no_argument,       NULL, 'h'}
+            {"broker-host",     required_argument, NULL, 'b'},
+            {"broker-port",     required_argument, NULL, 'p'},
+            {"client-id",       required_argument, NULL, 'i'},
+            {"topic",           required_argument, NULL, 't'},
+            {"qos",             required_argument, NULL, 'q'},
+            {"clean-session",   no_argument,       NULL, 'c'},
+            {"max-packet-size", required_argument, NULL, 'm'},
+            {"help",            no_argument,       NULL, 'h'}
     };
 
 
     int ch;
-    while ((ch = getopt_long(argc, argv, "b:p:i:t:q:ch", longopts, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "b:p:i:t:q:cm:h", longopts, NULL)) != -1) {
         switch (ch) {
             case 'b':
                 options.broker_host = optarg;
@@ -341,6 +348,9 @@ void parse_arguments(int argc, char *argv[]) {
             case 'c':
                 options.clean_session = true;
                 break;
+            case 'm':
+                options.max_packet_size = static_cast<size_t>(atol(optarg));
+                break;
             case 'h':
                 usage();
                 std::exit(0);
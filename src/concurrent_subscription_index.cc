@@ -0,0 +1,106 @@
+/**
+ * @file concurrent_subscription_index.cc
+ */
+
+#include "concurrent_subscription_index.h"
+
+#include <thread>
+
+const size_t ConcurrentSubscriptionIndex::ReadIndicatorSlots;
+
+size_t ConcurrentSubscriptionIndex::ReadIndicator::arrive() const {
+    size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % ReadIndicatorSlots;
+    counters[slot].readers.fetch_add(1);
+    return slot;
+}
+
+void ConcurrentSubscriptionIndex::ReadIndicator::depart(size_t slot) const {
+    counters[slot].readers.fetch_sub(1);
+}
+
+bool ConcurrentSubscriptionIndex::ReadIndicator::empty() const {
+    for (auto &counter : counters) {
+        if (counter.readers.load() != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ConcurrentSubscriptionIndex::insert(BrokerSession *session, const Subscription &subscription) {
+    write([session, &subscription](SubscriptionIndex &index) { index.insert(session, subscription); });
+}
+
+bool ConcurrentSubscriptionIndex::erase(BrokerSession *session, const TopicFilter &topic_filter) {
+    bool erased = false;
+    write([session, &topic_filter, &erased](SubscriptionIndex &index) {
+        erased = index.erase(session, topic_filter);
+    });
+    return erased;
+}
+
+void ConcurrentSubscriptionIndex::match(const TopicName &topic_name, ShareStrategy strategy,
+                                        std::vector<Subscriber> &subscribers) const {
+
+    int reader_version = version.load();
+    size_t slot = read_indicators[reader_version].arrive();
+
+    const SubscriptionIndex &index = indexes[published.load()];
+
+    size_t first = subscribers.size();
+    index.match(topic_name, subscribers);
+
+    // Groups belong to the copy, resolve them before leaving it
+    for (size_t i = first; i < subscribers.size(); i++) {
+        if (subscribers[i].group) {
+            subscribers[i] = subscribers[i].group->select(topic_name, strategy);
+        }
+    }
+
+    read_indicators[reader_version].depart(slot);
+}
+
+size_t ConcurrentSubscriptionIndex::size() const {
+
+    int reader_version = version.load();
+    size_t slot = read_indicators[reader_version].arrive();
+
+    size_t count = indexes[published.load()].size();
+
+    read_indicators[reader_version].depart(slot);
+
+    return count;
+}
+
+void ConcurrentSubscriptionIndex::write(const std::function<void(SubscriptionIndex &)> &change) {
+
+    std::lock_guard<std::mutex> lock(writer_mutex);
+
+    int old_copy = published.load();
+    int new_copy = 1 - old_copy;
+
+    change(indexes[new_copy]);
+    published.store(new_copy);
+
+    wait_for_readers();
+
+    change(indexes[old_copy]);
+}
+
+void ConcurrentSubscriptionIndex::wait_for_readers() {
+
+    // A reader registered with either indicator may have loaded the old copy position.  New readers are moved to the
+    // other indicator between the two waits, so once both have drained no reader can still be using the old copy.
+    int old_version = version.load();
+    int new_version = 1 - old_version;
+
+    while (!read_indicators[new_version].empty()) {
+        std::this_thread::yield();
+    }
+
+    version.store(new_version);
+
+    while (!read_indicators[old_version].empty()) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,137 @@
+/**
+ * @file concurrent_subscription_index.h
+ *
+ * Subscription index for concurrent readers.
+ *
+ * Publishing threads look up subscribers far more often than sessions subscribe or unsubscribe.  The
+ * ConcurrentSubscriptionIndex lets any number of threads match topic names without taking a lock while writers make
+ * changes.
+ *
+ * The index keeps two copies of a SubscriptionIndex, following the left-right technique.  Readers use whichever copy
+ * is currently published.  A writer applies its change to the unpublished copy, publishes that copy with an atomic
+ * store, waits for readers still using the old copy to leave it, then applies the same change to the old copy.
+ * Readers never see a partly applied change and the old copy is never modified while it is being read, so no copy of
+ * the index or of its nodes has to be retired and reclaimed later.
+ *
+ * Readers announce themselves in one of several counters chosen by thread so that concurrent readers rarely share a
+ * cache line.  Writers are serialized by a mutex and pay for both copies, which suits indexes that change rarely.
+ *
+ * Only the match itself is free of locks.  Lookups take an interned TopicName, and constructing a TopicName or
+ * releasing the last reference to one takes the process wide symbol table mutex.  Publishing threads that build a
+ * TopicName for every lookup therefore still serialize on that mutex once per message.  A thread that keeps the
+ * TopicName of a topic it publishes to and passes the same instance to each lookup does not.
+ */
+
+#pragma once
+
+#include "subscription_index.h"
+#include "shared_subscription.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+/**
+ * ConcurrentSubscriptionIndex class
+ *
+ * Thread safe wrapper over two SubscriptionIndex copies with lock free matching of an already interned TopicName.
+ */
+class ConcurrentSubscriptionIndex {
+public:
+
+    /**
+     * Add a subscription to the index.
+     *
+     * Blocks until readers of the previously published copy have finished.
+     *
+     * @param session      Pointer to the subscribing session.
+     * @param subscription Reference to the subscription.
+     */
+    void insert(BrokerSession *session, const Subscription &subscription);
+
+    /**
+     * Remove a subscription from the index.
+     *
+     * Blocks until readers of the previously published copy have finished.
+     *
+     * @param session      Pointer to the subscribing session.
+     * @param topic_filter Topic filter to remove.
+     * @return             A subscription was removed.
+     */
+    bool erase(BrokerSession *session, const TopicFilter &topic_filter);
+
+    /**
+     * Find the sessions receiving a message published to a topic name.
+     *
+     * Matching is done as in SubscriptionIndex::match.  Each matching shared group is resolved to the member chosen by
+     * the strategy while the copy is still in use, so every appended subscriber refers to a session.  Takes no locks,
+     * but constructing or releasing the TopicName passed in takes the symbol table mutex, see the file comment.
+     *
+     * @param topic_name  Reference to the published TopicName.
+     * @param strategy    Strategy choosing the member of a shared group.
+     * @param subscribers Container to append the receiving sessions to.
+     */
+    void match(const TopicName &topic_name, ShareStrategy strategy, std::vector<Subscriber> &subscribers) const;
+
+    /**
+     * Number of subscriptions in the published copy.
+     *
+     * @return Subscription count.
+     */
+    size_t size() const;
+
+private:
+
+    /** Number of reader counters. */
+    static const size_t ReadIndicatorSlots = 16;
+
+    /**
+     * Count of readers using a copy, spread over counters padded to separate cache lines.
+     */
+    class ReadIndicator {
+    public:
+
+        /** Register a reader on the calling thread's counter, returns the counter to pass to depart. */
+        size_t arrive() const;
+
+        /** Unregister a reader. */
+        void depart(size_t slot) const;
+
+        /** No readers are registered. */
+        bool empty() const;
+
+    private:
+
+        struct alignas(64) Counter {
+            std::atomic<long> readers{0};
+        };
+
+        mutable Counter counters[ReadIndicatorSlots];
+    };
+
+    /**
+     * Apply a change to both copies, publishing the changed copy first.
+     *
+     * @param change Function applying the change to a copy, called once for each copy.
+     */
+    void write(const std::function<void(SubscriptionIndex &)> &change);
+
+    /** Wait for readers of the copy that was published before the last write to finish. */
+    void wait_for_readers();
+
+    /** The two copies. */
+    SubscriptionIndex indexes[2];
+
+    /** Position of the published copy. */
+    std::atomic<int> published{0};
+
+    /** Reader counters, readers arrive at the counter selected by version. */
+    ReadIndicator read_indicators[2];
+
+    /** Position of the read indicator new readers arrive at. */
+    std::atomic<int> version{0};
+
+    /** Serializes writers. */
+    std::mutex writer_mutex;
+};
@@ -8,81 +8,127 @@
 #include <cassert>
 
 void Packet::read_fixed_header(PacketDataReader &reader) {
+    if (decode_fixed_header(reader) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus Packet::decode_fixed_header(PacketDataReader &reader) {
 
-    uint8_t command_header = reader.read_byte();
+    uint8_t command_header;
+    if (!reader.read_byte(command_header)) {
+        return reader.get_status();
+    }
     type = static_cast<PacketType>(command_header >> 4);
     header_flags = command_header & 0x0F;
 
-    size_t remaining_length = reader.read_remaining_length();
+    size_t remaining_length;
+    if (!reader.read_remaining_length(remaining_length)) {
+        return reader.get_status();
+    }
     if (remaining_length != reader.get_packet_data().size() - reader.get_offset()) {
+        return DecodeStatus::LengthMismatch;
+    }
+    return DecodeStatus::Ok;
+}
+
+size_t Packet::encoded_size() const {
+    size_t length = remaining_length();
+    return 1 + PacketDataWriter::remaining_length_size(length) + length;
+}
+
+packet_data_t Packet::serialize() const {
+    packet_data_t packet_data(encoded_size());
+    encode_to(packet_data.data());
+    return packet_data;
+}
+
+void Packet::write_fixed_header(PacketDataWriter &writer) const {
+    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
+    writer.write_remaining_length(remaining_length());
+}
+
+ConnectPacket::ConnectPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
         throw std::exception();
     }
 }
 
-ConnectPacket::ConnectPacket(const packet_data_t &packet_data) {
+DecodeStatus ConnectPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Connect) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    protocol_name = reader.read_string();
-    protocol_level = reader.read_byte();
-    connect_flags = reader.read_byte();
-    keep_alive = reader.read_uint16();
-    client_id = reader.read_string();
+    if (!reader.read_string(protocol_name) or !reader.read_byte(protocol_level) or !reader.read_byte(connect_flags) or
+        !reader.read_uint16(keep_alive) or !reader.read_string(client_id)) {
+        return reader.get_status();
+    }
 
     if (client_id.empty()) {
         client_id = generate_client_id();
     }
 
     if (will_flag()) {
-        will_topic = reader.read_string();
-        will_message = reader.read_bytes();
+        if (!reader.read_string(will_topic) or !reader.read_bytes(will_message)) {
+            return reader.get_status();
+        }
     }
 
     if (username_flag()) {
-        username = reader.read_string();
+        if (!reader.read_string(username)) {
+            return reader.get_status();
+        }
     }
 
     if (password_flag()) {
-        password = reader.read_bytes();
+        if (!reader.read_bytes(password)) {
+            return reader.get_status();
+        }
     }
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t ConnectPacket::serialize() const {
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
+size_t ConnectPacket::remaining_length() const {
 
-    size_t remaining_length = 2 + protocol_name.size();
+    size_t remaining_length = PacketDataWriter::string_size(protocol_name);
     remaining_length += 1; // protocol_level
     remaining_length += 1; // connect_flags
     remaining_length += 2; // keep_alive
-    remaining_length += 2 + client_id.size();
+    remaining_length += PacketDataWriter::string_size(client_id);
 
     if (will_flag()) {
-        remaining_length += 2 + will_topic.size();
-        remaining_length += 2 + will_message.size();
+        remaining_length += PacketDataWriter::string_size(will_topic);
+        remaining_length += PacketDataWriter::bytes_size(will_message);
     }
 
     if (username_flag()) {
-        remaining_length += 2 + username.size();
+        remaining_length += PacketDataWriter::string_size(username);
     }
 
     if (password_flag()) {
-        remaining_length += 2 + password.size();
+        remaining_length += PacketDataWriter::bytes_size(password);
     }
 
-    writer.write_remaining_length(remaining_length);
+    return remaining_length;
+}
+
+void ConnectPacket::encode_to(uint8_t *data) const {
+
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_string(protocol_name);
     writer.write_byte(protocol_level);
     writer.write_byte(connect_flags);
@@ -101,410 +147,697 @@ packet_data_t ConnectPacket::serialize() const {
     if (password_flag()) {
         writer.write_bytes(password);
     }
+}
 
-    return packet_data;
+ConnackPacket::ConnackPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
 }
 
-ConnackPacket::ConnackPacket(const packet_data_t &packet_data) {
+DecodeStatus ConnackPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Connack) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
+    }
+
+    uint8_t code;
+    if (!reader.read_byte(acknowledge_flags) or !reader.read_byte(code)) {
+        return reader.get_status();
     }
+    return_code = static_cast<ReturnCode>(code);
 
-    acknowledge_flags = reader.read_byte();
-    return_code = static_cast<ReturnCode>(reader.read_byte());
+    return DecodeStatus::Ok;
 }
 
-packet_data_t ConnackPacket::serialize() const {
+size_t ConnackPacket::remaining_length() const {
+    return 2;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
+void ConnackPacket::encode_to(uint8_t *data) const {
 
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2);
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_byte(acknowledge_flags);
     writer.write_byte(static_cast<uint8_t>(return_code));
-    return packet_data;
 }
 
-PublishPacket::PublishPacket(const packet_data_t &packet_data) {
+PublishPacket::PublishPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus PublishPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Publish) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
-    topic_name = reader.read_string();
+    std::string topic_name;
+    if (!reader.read_string(topic_name)) {
+        return reader.get_status();
+    }
+    if (!TopicName::is_valid(topic_name)) {
+        return DecodeStatus::InvalidTopic;
+    }
 
     if (qos() != QoSType::QoS0) {
-        packet_id = reader.read_uint16();
+        if (!reader.read_uint16(packet_id)) {
+            return reader.get_status();
+        }
     }
 
     size_t payload_len = packet_data.size() - reader.get_offset();
 
-    message_data = reader.read_bytes(payload_len);
+    std::vector<uint8_t> payload;
+    if (!reader.read_bytes(payload_len, payload)) {
+        return reader.get_status();
+    }
+
+    message = std::make_shared<Message>(std::move(topic_name), std::move(payload));
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PublishPacket::serialize() const {
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
+DecodeStatus PublishPacket::decode_header(const PacketDataView &header_data, size_t &payload_length) {
+
+    PacketDataReader reader(header_data);
+
+    uint8_t command_header;
+    size_t remaining_length;
+    if (!reader.read_byte(command_header) or !reader.read_remaining_length(remaining_length)) {
+        return reader.get_status();
+    }
+    type = static_cast<PacketType>(command_header >> 4);
+    header_flags = command_header & 0x0F;
+
+    if (type != PacketType::Publish) {
+        return DecodeStatus::BadType;
+    }
+
+    size_t fixed_header_length = reader.get_offset();
+
+    std::string topic_name;
+    if (!reader.read_string(topic_name)) {
+        return reader.get_status();
+    }
+    if (!TopicName::is_valid(topic_name)) {
+        return DecodeStatus::InvalidTopic;
+    }
+
+    if (qos() != QoSType::QoS0) {
+        if (!reader.read_uint16(packet_id)) {
+            return reader.get_status();
+        }
+    }
+
+    if (reader.get_offset() - fixed_header_length > remaining_length) {
+        return DecodeStatus::LengthMismatch;
+    }
+
+    payload_length = remaining_length - (reader.get_offset() - fixed_header_length);
+    message = std::make_shared<Message>(std::move(topic_name), std::vector<uint8_t>());
+
+    return DecodeStatus::Ok;
+}
+
+size_t PublishPacket::header_size(size_t payload_length) const {
+
+    size_t variable_header_length = PacketDataWriter::string_size(message->topic_name);
+    if (qos() != QoSType::QoS0) {
+        variable_header_length += 2;
+    }
+    return 1 + PacketDataWriter::remaining_length_size(variable_header_length + payload_length) +
+           variable_header_length;
+}
+
+void PublishPacket::encode_header_to(uint8_t *data, size_t payload_length) const {
+
+    size_t variable_header_length = PacketDataWriter::string_size(message->topic_name);
+    if (qos() != QoSType::QoS0) {
+        variable_header_length += 2;
+    }
+
+    PacketDataWriter writer(data);
     writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    uint16_t remaining_length = 2 + topic_name.size() + message_data.size();
+    writer.write_remaining_length(variable_header_length + payload_length);
+    writer.write_string(message->topic_name);
+    if (qos() != QoSType::QoS0) {
+        writer.write_uint16(packet_id);
+    }
+}
+
+size_t PublishPacket::remaining_length() const {
+
+    size_t remaining_length = PacketDataWriter::string_size(message->topic_name) + message->payload.size();
     if (qos() != QoSType::QoS0) {
         remaining_length += 2;
     }
-    writer.write_remaining_length(remaining_length);
-    writer.write_string(topic_name);
+    return remaining_length;
+}
+
+void PublishPacket::encode_to(uint8_t *data) const {
+
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
+    writer.write_string(message->topic_name);
     if (qos() != QoSType::QoS0) {
         writer.write_uint16(packet_id);
     }
-    for (size_t i = 0; i < message_data.size(); i++) {
-        writer.write_byte(message_data[i]);
+    writer.write_raw(message->payload.data(), message->payload.size());
+}
+
+const packet_data_t &Message::wire_header(bool packet_id) const {
+
+    packet_data_t &packet_data = wire_headers[packet_id];
+
+    if (packet_data.empty()) {
+        size_t variable_header_length = PacketDataWriter::string_size(topic_name);
+        if (packet_id) {
+            variable_header_length += 2;
+        }
+        size_t remaining_length = variable_header_length + payload.size();
+        packet_data.resize(1 + PacketDataWriter::remaining_length_size(remaining_length) + variable_header_length);
+
+        PacketDataWriter writer(packet_data);
+        writer.write_byte(static_cast<uint8_t>(PacketType::Publish) << 4);
+        writer.write_remaining_length(remaining_length);
+        writer.write_string(topic_name);
+        if (packet_id) {
+            writer.write_uint16(0);
+        }
     }
 
     return packet_data;
 }
 
-PubackPacket::PubackPacket(const packet_data_t &packet_data) {
+const std::shared_ptr<const Message> &Message::empty() {
+    static const std::shared_ptr<const Message> empty_message = std::make_shared<Message>();
+    return empty_message;
+}
+
+PubackPacket::PubackPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus PubackPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Puback) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    packet_id = reader.read_uint16();
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
+    }
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PubackPacket::serialize() const {
+size_t PubackPacket::remaining_length() const {
+    return 2;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2);
+void PubackPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
-    return packet_data;
 }
 
-PubrecPacket::PubrecPacket(const packet_data_t &packet_data) {
+PubrecPacket::PubrecPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus PubrecPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Pubrec) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    packet_id = reader.read_uint16();
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
+    }
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PubrecPacket::serialize() const {
+size_t PubrecPacket::remaining_length() const {
+    return 2;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2);
+void PubrecPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
-    return packet_data;
 }
 
-PubrelPacket::PubrelPacket(const packet_data_t &packet_data) {
+PubrelPacket::PubrelPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus PubrelPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Pubrel) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0x02) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    packet_id = reader.read_uint16();
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
+    }
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PubrelPacket::serialize() const {
+size_t PubrelPacket::remaining_length() const {
+    return 2;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2);
+void PubrelPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
-    return packet_data;
 }
 
-PubcompPacket::PubcompPacket(const packet_data_t &packet_data) {
+PubcompPacket::PubcompPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus PubcompPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Pubcomp) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    packet_id = reader.read_uint16();
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
+    }
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PubcompPacket::serialize() const {
+size_t PubcompPacket::remaining_length() const {
+    return 2;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2);
+void PubcompPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
-    return packet_data;
 }
 
-SubscribePacket::SubscribePacket(const packet_data_t &packet_data) {
+SubscribePacket::SubscribePacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus SubscribePacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Subscribe) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0x02) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    packet_id = reader.read_uint16();
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
+    }
+
+    subscriptions.clear();
 
     do {
-        std::string topic = reader.read_string();
-        QoSType qos = static_cast<QoSType>(reader.read_byte());
-        // TODO use emplace_back
-        subscriptions.push_back(Subscription{topic, qos});
+        std::string topic;
+        uint8_t qos;
+        if (!reader.read_string(topic) or !reader.read_byte(qos)) {
+            return reader.get_status();
+        }
+        std::shared_ptr<const InternedTopic> topic_filter = TopicFilter::intern_filter(topic);
+        if (!topic_filter) {
+            return DecodeStatus::InvalidTopic;
+        }
+        subscriptions.push_back(Subscription{TopicFilter(std::move(topic_filter)), static_cast<QoSType>(qos)});
     } while (!reader.empty());
-}
-
-packet_data_t SubscribePacket::serialize() const {
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
+    return DecodeStatus::Ok;
+}
 
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
+size_t SubscribePacket::remaining_length() const {
 
     size_t remaining_length = 2;
-    for (auto subscription : subscriptions) {
-        remaining_length += 1 + 2 + std::string(subscription.topic_filter).size();
+    for (auto &subscription : subscriptions) {
+        remaining_length += PacketDataWriter::string_size(subscription.topic_filter.interned()->text) + 1;
     }
+    return remaining_length;
+}
 
-    writer.write_remaining_length(remaining_length);
+void SubscribePacket::encode_to(uint8_t *data) const {
+
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
 
-    for (auto subscription : subscriptions) {
-        writer.write_string(std::string(subscription.topic_filter));
+    for (auto &subscription : subscriptions) {
+        writer.write_string(subscription.topic_filter.interned()->text);
         writer.write_byte(static_cast<uint8_t>(subscription.qos));
     }
+}
 
-    return packet_data;
-
+SubackPacket::SubackPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
 }
 
-SubackPacket::SubackPacket(const packet_data_t &packet_data) {
+DecodeStatus SubackPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Suback) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
+    }
+
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
     }
 
-    packet_id = reader.read_uint16();
+    return_codes.clear();
 
     do {
-        ReturnCode return_code = static_cast<ReturnCode>(reader.read_byte());
-        return_codes.push_back(return_code);
+        uint8_t return_code;
+        if (!reader.read_byte(return_code)) {
+            return reader.get_status();
+        }
+        return_codes.push_back(static_cast<ReturnCode>(return_code));
     } while (!reader.empty());
+
+    return DecodeStatus::Ok;
 }
 
-packet_data_t SubackPacket::serialize() const {
+size_t SubackPacket::remaining_length() const {
+    return 2 + return_codes.size();
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2 + return_codes.size());
+void SubackPacket::encode_to(uint8_t *data) const {
+
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
     for (auto return_code : return_codes) {
         writer.write_byte(static_cast<uint8_t>(return_code));
     }
-    return packet_data;
 }
 
-UnsubscribePacket::UnsubscribePacket(const packet_data_t &packet_data) {
+UnsubscribePacket::UnsubscribePacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus UnsubscribePacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Unsubscribe) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0x02) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
+    }
+
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
     }
 
-    packet_id = reader.read_uint16();
+    topics.clear();
 
     do {
-        topics.push_back(reader.read_string());
+        std::string topic;
+        if (!reader.read_string(topic)) {
+            return reader.get_status();
+        }
+        if (!TopicFilter::intern_filter(topic)) {
+            return DecodeStatus::InvalidTopic;
+        }
+        topics.push_back(std::move(topic));
     } while (!reader.empty());
+
+    return DecodeStatus::Ok;
 }
 
-packet_data_t UnsubscribePacket::serialize() const {
+size_t UnsubscribePacket::remaining_length() const {
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    size_t topics_size = 0;
-    for (auto topic : topics) {
-        // string data + 2 byte length
-        topics_size += topic.size() + 2;
+    size_t remaining_length = 2;
+    for (auto &topic : topics) {
+        remaining_length += PacketDataWriter::string_size(topic);
     }
-    writer.write_remaining_length(2 + topics_size);
+    return remaining_length;
+}
+
+void UnsubscribePacket::encode_to(uint8_t *data) const {
+
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
-    for (auto topic : topics) {
+    for (auto &topic : topics) {
         writer.write_string(topic);
     }
-    return packet_data;
 }
 
-UnsubackPacket::UnsubackPacket(const packet_data_t &packet_data) {
+UnsubackPacket::UnsubackPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus UnsubackPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Unsuback) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
-    packet_id = reader.read_uint16();
+    if (!reader.read_uint16(packet_id)) {
+        return reader.get_status();
+    }
+
+    return DecodeStatus::Ok;
 }
 
-packet_data_t UnsubackPacket::serialize() const {
+size_t UnsubackPacket::remaining_length() const {
+    return 2;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(2);
+void UnsubackPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
     writer.write_uint16(packet_id);
-    return packet_data;
 }
 
-PingreqPacket::PingreqPacket(const packet_data_t &packet_data) {
+PingreqPacket::PingreqPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
+}
+
+DecodeStatus PingreqPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Pingreq) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
+
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PingreqPacket::serialize() const {
+size_t PingreqPacket::remaining_length() const {
+    return 0;
+}
 
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(0);
-    return packet_data;
+void PingreqPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
+}
+
+PingrespPacket::PingrespPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
 }
 
-PingrespPacket::PingrespPacket(const packet_data_t &packet_data) {
+DecodeStatus PingrespPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Pingresp) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
+
+    return DecodeStatus::Ok;
 }
 
-packet_data_t PingrespPacket::serialize() const {
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(0);
-    return packet_data;
+size_t PingrespPacket::remaining_length() const {
+    return 0;
+}
+
+void PingrespPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
+}
+
+DisconnectPacket::DisconnectPacket(const PacketDataView &packet_data) {
+    if (decode(packet_data) != DecodeStatus::Ok) {
+        throw std::exception();
+    }
 }
 
-DisconnectPacket::DisconnectPacket(const packet_data_t &packet_data) {
+DecodeStatus DisconnectPacket::decode(const PacketDataView &packet_data) {
 
     PacketDataReader reader(packet_data);
 
-    read_fixed_header(reader);
+    DecodeStatus status = decode_fixed_header(reader);
+    if (status != DecodeStatus::Ok) {
+        return status;
+    }
 
     if (type != PacketType::Disconnect) {
-        throw std::exception();
+        return DecodeStatus::BadType;
     }
 
     if (header_flags != 0) {
-        throw std::exception();
+        return DecodeStatus::BadFlags;
     }
 
+    return DecodeStatus::Ok;
 }
 
-packet_data_t DisconnectPacket::serialize() const {
-    packet_data_t packet_data;
-    PacketDataWriter writer(packet_data);
-    writer.write_byte((static_cast<uint8_t>(type) << 4) | (header_flags & 0x0F));
-    writer.write_remaining_length(0);
-    return packet_data;
+size_t DisconnectPacket::remaining_length() const {
+    return 0;
+}
+
+void DisconnectPacket::encode_to(uint8_t *data) const {
+    PacketDataWriter writer(data);
+    write_fixed_header(writer);
 }
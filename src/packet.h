@@ -6,9 +6,13 @@
  * The MQTT 3.1.1 standard specifies the wire-level structure and operational behavior protocol control packets.  This
  * structure and some low level behavior is implemented here.
  *
- * Serialization of a control packet instance to wire format is accomplisted through instance serialization methods.
+ * Serialization of a control packet instance to wire format is accomplisted through instance encoding methods.  The
+ * exact encoded size is known before encoding so packets can be written directly into preallocated memory.
  *
- * Deserialization from the wire level is handled by a control packet constructor that accepts a octect sequence.
+ * Deserialization from the wire level is handled by a control packet decode method that accepts a view of an octet
+ * sequence.  The view may point directly into the network input buffer so fields are copied out as they are parsed.
+ * Decoding reports malformed packets through a DecodeStatus without throwing.  A constructor accepting a view wraps
+ * the decode method and throws if the packet is malformed.
  *
  * Control packet instances also provide a default constructor that will create an instance using default values.
  */
@@ -72,10 +76,59 @@ public:
     QoSType qos;
 };
 
+/**
+ * Message class
+ *
+ * The topic name and payload of a published application message.  A message is immutable once created and is shared
+ * through reference counted pointers by the received PublishPacket and every packet forwarding it to subscribers, so
+ * a message fanned out to many subscribers is held in memory once.
+ */
+class Message {
+public:
+
+    Message() {}
+
+    Message(std::string topic_name, std::vector<uint8_t> payload) : topic_name(std::move(topic_name)),
+                                                                    payload(std::move(payload)) {}
+
+    const std::string topic_name;
+    const std::vector<uint8_t> payload;
+
+    /**
+     * Wire header of a publish control packet carrying this message.
+     *
+     * The fixed header and the variable header, topic name and packet id, that precede the payload on the wire.  The
+     * header is encoded on first use and kept for later deliveries, so a message fanned out to many subscribers is
+     * encoded once for QoS 0 and once for QoS 1 and 2, which share a layout.  The payload is not part of the header,
+     * senders write it from the message itself so the message holds its payload once.  The header flags are left
+     * clear and the packet id is zero, senders patch both for each delivery.
+     *
+     * @param packet_id The header includes a packet id, true for QoS 1 and 2.
+     * @return          Reference to the encoded header.
+     */
+    const packet_data_t &wire_header(bool packet_id) const;
+
+    /**
+     * Shared empty message.
+     *
+     * Default constructed publish packets refer to this until a message is assigned, so creating a packet to decode
+     * into does not allocate a message.
+     *
+     * @return Shared pointer to the empty message.
+     */
+    static const std::shared_ptr<const Message> &empty();
+
+private:
+
+    /** Encoded headers, indexed by whether they include a packet id, empty until first used. */
+    mutable packet_data_t wire_headers[2];
+};
+
 /**
  * Abstract base control packet class.
  *
- * Packet classes inherit this and extend as necessary.  The serialize method implementation is required.
+ * Packet classes inherit this and extend as necessary.  The remaining_length and encode_to method implementations are
+ * required.
  */
 class Packet {
 public:
@@ -86,8 +139,60 @@ public:
 
     void read_fixed_header(PacketDataReader &);
 
-    //  static Packet unserialize(const packet_data_t &);
-    virtual packet_data_t serialize(void) const = 0;
+    /**
+     * Decode the command header byte and remaining length.
+     *
+     * Sets the packet type and header flags and checks the remaining length matches the size of the packet.
+     *
+     * @param reader Reference to the reader, positioned at the start of the packet.
+     * @return       Decode status.
+     */
+    DecodeStatus decode_fixed_header(PacketDataReader &reader);
+
+    /**
+     * Decode a complete packet of this type into a default constructed packet.
+     *
+     * @param packet_data View of the packet data.
+     * @return            DecodeStatus::Ok, or the reason the packet is malformed.
+     */
+    virtual DecodeStatus decode(const PacketDataView &packet_data) = 0;
+
+    /**
+     * Length of the packet following the fixed header.
+     *
+     * @return Remaining length value.
+     */
+    virtual size_t remaining_length() const = 0;
+
+    /**
+     * Exact size of the wire format of this packet.
+     *
+     * @return Number of bytes written by encode_to.
+     */
+    size_t encoded_size() const;
+
+    /**
+     * Encode this packet to wire format.
+     *
+     * @param data Pointer to memory holding at least encoded_size() bytes.
+     */
+    virtual void encode_to(uint8_t *data) const = 0;
+
+    /**
+     * Encode this packet into a new packet_data_t container.
+     *
+     * @return Container holding the wire format.
+     */
+    packet_data_t serialize() const;
+
+protected:
+
+    /**
+     * Write the command header byte and remaining length.
+     *
+     * @param writer Reference to the writer, positioned at the start of the packet.
+     */
+    void write_fixed_header(PacketDataWriter &writer) const;
 
 };
 
@@ -102,11 +207,17 @@ public:
         header_flags = 0;
         protocol_name = "MQIsdp";
         protocol_level = 4;
+        connect_flags = 0;
+        keep_alive = 0;
     }
 
-    ConnectPacket(const packet_data_t &packet_data);
+    ConnectPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     std::string protocol_name;
     uint8_t protocol_level;
@@ -197,9 +308,12 @@ public:
     ConnackPacket() {
         type = PacketType::Connack;
         header_flags = 0;
+        acknowledge_flags = 0;
     }
 
-    ConnackPacket(const packet_data_t &packet_data);
+    ConnackPacket(const PacketDataView &packet_data);
+
+    DecodeStatus decode(const PacketDataView &packet_data) override;
 
     enum class ReturnCode : uint8_t {
         Accepted = 0x00,
@@ -210,7 +324,9 @@ public:
         NotAuthorized = 0x05
     };
 
-    packet_data_t serialize() const;
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint8_t acknowledge_flags;
     ReturnCode return_code;
@@ -235,18 +351,69 @@ public:
 class PublishPacket : public Packet {
 public:
 
-    PublishPacket() {
+    PublishPacket() : message(Message::empty()) {
         type = PacketType::Publish;
         header_flags = 0;
     }
 
-    PublishPacket(const packet_data_t &packet_data);
+    PublishPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
 
-    std::string topic_name;
-    std::vector<uint8_t> message_data;
-    uint16_t packet_id;
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
+
+    /** Shared message, copies of the packet refer to the same message. */
+    std::shared_ptr<const Message> message;
+    uint16_t packet_id = 0;
+
+    const std::string &topic_name() const {
+        return message->topic_name;
+    }
+
+    const std::vector<uint8_t> &message_data() const {
+        return message->payload;
+    }
+
+    /**
+     * Decode the fixed and variable headers of a publish packet whose payload has not been received.
+     *
+     * Used to stream large payloads, the message is left with the topic name and an empty payload.
+     *
+     * @param header_data    View of the packet data up to the end of the variable header.
+     * @param payload_length Set to the length of the payload following the headers.
+     * @return               DecodeStatus::Ok, or the reason the headers are malformed.
+     */
+    DecodeStatus decode_header(const PacketDataView &header_data, size_t &payload_length);
+
+    /**
+     * Size of the fixed and variable headers of this publish for a payload of a given length.
+     *
+     * @param payload_length Length of the payload.
+     * @return               Number of bytes written by encode_header_to.
+     */
+    size_t header_size(size_t payload_length) const;
+
+    /**
+     * Encode the fixed and variable headers of this publish for a payload of a given length.
+     *
+     * The payload is written separately, see PacketManager::open_output_stream.
+     *
+     * @param data           Pointer to memory holding at least header_size(payload_length) bytes.
+     * @param payload_length Length of the payload.
+     */
+    void encode_header_to(uint8_t *data, size_t payload_length) const;
+
+    /**
+     * Offset of the packet id in the wire header of a QoS 1 or 2 publish.
+     *
+     * @param header The message wire header including a packet id.
+     * @return       Offset of the most significant packet id byte.
+     */
+    size_t packet_id_offset(const packet_data_t &header) const {
+        return header.size() - 2;
+    }
 
     bool dup() const {
         return header_flags & 0x08;
@@ -265,7 +432,7 @@ public:
     }
 
     void qos(QoSType qos) {
-        header_flags |= static_cast<uint8_t>(qos) << 1;
+        header_flags = (header_flags & ~0x06) | (static_cast<uint8_t>(qos) << 1);
     }
 
     bool retain() const {
@@ -293,9 +460,13 @@ public:
         header_flags = 0;
     }
 
-    PubackPacket(const packet_data_t &packet_data);
+    PubackPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 };
@@ -312,9 +483,13 @@ public:
         header_flags = 0;
     }
 
-    PubrecPacket(const packet_data_t &packet_data);
+    PubrecPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 };
@@ -331,9 +506,13 @@ public:
         header_flags = 0x02;
     }
 
-    PubrelPacket(const packet_data_t &packet_data);
+    PubrelPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 };
@@ -350,9 +529,13 @@ public:
         header_flags = 0;
     }
 
-    PubcompPacket(const packet_data_t &packet_data);
+    PubcompPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 };
@@ -369,9 +552,13 @@ public:
         header_flags = 0x02;
     }
 
-    SubscribePacket(const packet_data_t &packet_data);
+    SubscribePacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 
@@ -391,9 +578,13 @@ public:
         header_flags = 0;
     }
 
-    SubackPacket(const packet_data_t &packet_data);
+    SubackPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     enum class ReturnCode : uint8_t {
         SuccessQoS0 = 0x00,
@@ -419,9 +610,13 @@ public:
         header_flags = 0x02;
     }
 
-    UnsubscribePacket(const packet_data_t &packet_data);
+    UnsubscribePacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 
@@ -441,9 +636,13 @@ public:
         header_flags = 0;
     }
 
-    UnsubackPacket(const packet_data_t &packet_data);
+    UnsubackPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 
     uint16_t packet_id;
 
@@ -461,9 +660,13 @@ public:
         header_flags = 0;
     }
 
-    PingreqPacket(const packet_data_t &packet_data);
+    PingreqPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 };
 
 /**
@@ -478,9 +681,13 @@ public:
         header_flags = 0;
     }
 
-    PingrespPacket(const packet_data_t &packet_data);
+    PingrespPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 };
 
 /**
@@ -495,8 +702,12 @@ public:
         header_flags = 0;
     }
 
-    DisconnectPacket(const packet_data_t &packet_data);
+    DisconnectPacket(const PacketDataView &packet_data);
 
-    packet_data_t serialize() const;
+    DecodeStatus decode(const PacketDataView &packet_data) override;
+
+    size_t remaining_length() const override;
+
+    void encode_to(uint8_t *data) const override;
 };
 
@@ -0,0 +1,143 @@
+/**
+ * @file packet_arena.h
+ *
+ * Bump allocator for short lived decoded packets.
+ *
+ * Control packets received in one read callback are only needed until they have been dispatched.  Each PacketManager
+ * decodes them into its own PacketArena and resets the arena once the read callback finishes dispatching, which
+ * destroys the packets and rewinds the arena.  Blocks are kept across resets so a connection in steady state decodes
+ * packets without touching the heap.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * PacketArena class
+ *
+ * Objects are placed one after another in fixed size blocks and destroyed together, in reverse order of creation, by
+ * reset.  Allocations larger than a block get memory of their own which is released by reset.
+ */
+class PacketArena {
+public:
+
+    /** Size of a standard block in bytes. */
+    static const size_t BlockSize = 4096;
+
+    PacketArena() {}
+
+    ~PacketArena() { reset(); }
+
+    PacketArena(const PacketArena &) = delete;
+
+    PacketArena &operator=(const PacketArena &) = delete;
+
+    /**
+     * Construct an object in the arena.
+     *
+     * If the constructor throws the object's memory is reclaimed by the next reset.
+     *
+     * @param args Constructor arguments.
+     * @return     Pointer to the object, valid until the next reset.
+     */
+    template<typename T, typename... Args>
+    T *create(Args &&... args) {
+        void *memory = allocate(sizeof(T), alignof(T));
+        T *object = new(memory) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            destructors.push_back(Destructor{destroy<T>, object});
+        }
+        return object;
+    }
+
+    /**
+     * Allocate uninitialized memory.
+     *
+     * @param size      Number of bytes.
+     * @param alignment Required alignment, a power of two no larger than alignof(std::max_align_t).
+     * @return          Pointer to the memory, valid until the next reset.
+     */
+    void *allocate(size_t size, size_t alignment) {
+
+        if (size > BlockSize) {
+            large.emplace_back(new uint8_t[size]);
+            used += size;
+            return large.back().get();
+        }
+
+        size_t start = (offset + alignment - 1) & ~(alignment - 1);
+
+        if (current == blocks.size() or start + size > BlockSize) {
+            if (current == blocks.size() or ++current == blocks.size()) {
+                blocks.emplace_back(new uint8_t[BlockSize]);
+                current = blocks.size() - 1;
+            }
+            start = 0;
+        }
+
+        offset = start + size;
+        used += size;
+        return blocks[current].get() + start;
+    }
+
+    /**
+     * Destroy every object and rewind to the first block.
+     */
+    void reset() {
+
+        for (auto destructor = destructors.rbegin(); destructor != destructors.rend(); ++destructor) {
+            destructor->destroy(destructor->object);
+        }
+        destructors.clear();
+
+        large.clear();
+
+        current = 0;
+        offset = 0;
+        used = 0;
+    }
+
+    /** Number of bytes allocated since the last reset. */
+    size_t bytes_used() const { return used; }
+
+    /** Number of blocks held. */
+    size_t block_count() const { return blocks.size(); }
+
+private:
+
+    /** Destructor of an object in the arena. */
+    struct Destructor {
+        void (*destroy)(void *);
+        void *object;
+    };
+
+    template<typename T>
+    static void destroy(void *object) {
+        static_cast<T *>(object)->~T();
+    }
+
+    /** Blocks of BlockSize bytes, from new[] so their start is suitably aligned for any object. */
+    std::vector<std::unique_ptr<uint8_t[]>> blocks;
+
+    /** Memory of allocations larger than a block. */
+    std::vector<std::unique_ptr<uint8_t[]>> large;
+
+    /** Index of the block being filled, equal to blocks.size() before the first allocation. */
+    size_t current = 0;
+
+    /** Offset of the next free byte in the current block. */
+    size_t offset = 0;
+
+    /** Bytes allocated since the last reset. */
+    size_t used = 0;
+
+    /** Destructors of the objects in the arena, in order of creation. */
+    std::vector<Destructor> destructors;
+};
@@ -5,6 +5,41 @@
 #include "packet_data.h"
 
 #include <iostream>
+#include <cstring>
+
+const char *decode_status_name(DecodeStatus status) {
+    switch (status) {
+        case DecodeStatus::Ok:
+            return "ok";
+        case DecodeStatus::MalformedLength:
+            return "malformed length";
+        case DecodeStatus::LengthMismatch:
+            return "length mismatch";
+        case DecodeStatus::BadType:
+            return "bad type";
+        case DecodeStatus::BadFlags:
+            return "bad flags";
+        case DecodeStatus::Truncated:
+            return "truncated";
+        case DecodeStatus::TruncatedString:
+            return "truncated string";
+        case DecodeStatus::InvalidTopic:
+            return "invalid topic";
+        case DecodeStatus::PacketTooLarge:
+            return "packet too large";
+    }
+    return "unknown";
+}
+
+size_t PacketDataWriter::remaining_length_size(size_t length) {
+
+    size_t size = 1;
+    while (length > 127 and size < 4) {
+        length >>= 7;
+        size++;
+    }
+    return size;
+}
 
 void PacketDataWriter::write_remaining_length(size_t length) {
 
@@ -18,27 +53,34 @@ void PacketDataWriter::write_remaining_length(size_t length) {
         if (length > 0) {
             encoded_byte |= 0x80;
         }
-        packet_data.push_back(encoded_byte);
+        data[offset++] = encoded_byte;
     } while (length > 0);
 }
 
 void PacketDataWriter::write_byte(uint8_t byte) {
-    packet_data.push_back(byte);
+    data[offset++] = byte;
 }
 
 void PacketDataWriter::write_uint16(uint16_t word) {
-    packet_data.push_back((word >> 8) & 0xFF);
-    packet_data.push_back(word & 0xFF);
+    data[offset++] = (word >> 8) & 0xFF;
+    data[offset++] = word & 0xFF;
 }
 
 void PacketDataWriter::write_string(const std::string &s) {
     write_uint16(s.size());
-    std::copy(s.begin(), s.end(), std::back_inserter(packet_data));
+    write_raw(reinterpret_cast<const uint8_t *>(s.data()), s.size());
 }
 
 void PacketDataWriter::write_bytes(const packet_data_t & b) {
     write_uint16(b.size());
-    std::copy(b.begin(), b.end(), std::back_inserter(packet_data));
+    write_raw(b.data(), b.size());
+}
+
+void PacketDataWriter::write_raw(const uint8_t *b, size_t len) {
+    if (len != 0) {
+        std::memcpy(data + offset, b, len);
+        offset += len;
+    }
 }
 
 bool PacketDataReader::has_remaining_length() {
@@ -55,74 +97,130 @@ bool PacketDataReader::has_remaining_length() {
 }
 
 size_t PacketDataReader::read_remaining_length() {
+    size_t length;
+    if (!read_remaining_length(length)) {
+        throw std::exception();
+    }
+    return length;
+}
+
+uint8_t PacketDataReader::read_byte() {
+    uint8_t byte;
+    if (!read_byte(byte)) {
+        throw std::exception();
+    }
+    return byte;
+}
+
+uint16_t PacketDataReader::read_uint16() {
+    uint16_t word;
+    if (!read_uint16(word)) {
+        throw std::exception();
+    }
+    return word;
+}
+
+std::string PacketDataReader::read_string() {
+    std::string s;
+    if (!read_string(s)) {
+        throw std::exception();
+    }
+    return s;
+}
+
+std::vector<uint8_t> PacketDataReader::read_bytes() {
+    std::vector<uint8_t> v;
+    if (!read_bytes(v)) {
+        throw std::exception();
+    }
+    return v;
+}
+
+std::vector<uint8_t> PacketDataReader::read_bytes(size_t len) {
+    std::vector<uint8_t> v;
+    if (!read_bytes(len, v)) {
+        throw std::exception();
+    }
+    return v;
+}
+
+bool PacketDataReader::read_remaining_length(size_t &length) {
 
-    size_t starting_offset = offset;
     size_t value = 0;
-    int multiplier = 1;
+    size_t multiplier = 1;
 
-    do {
-        uint8_t encoded_byte = packet_data[offset++];
-        value += (encoded_byte & 0x7F) * multiplier;
+    for (size_t i = offset; i < offset + 4; i++) {
 
-        if ((encoded_byte & 0x80) == 0) {
-            break;
+        if (i >= packet_data.size()) {
+            return fail(DecodeStatus::MalformedLength);
         }
 
-        multiplier <<= 7;
+        uint8_t encoded_byte = packet_data[i];
+        value += (encoded_byte & 0x7F) * multiplier;
 
-        if (offset - starting_offset == 4) {
-            throw std::exception();
+        if ((encoded_byte & 0x80) == 0) {
+            offset = i + 1;
+            length = value;
+            return true;
         }
 
-    } while (1);
+        multiplier <<= 7;
+    }
 
-    return value;
+    return fail(DecodeStatus::MalformedLength);
 }
 
-uint8_t PacketDataReader::read_byte() {
-    if (offset > packet_data.size()) {
-        throw std::exception();
+bool PacketDataReader::read_byte(uint8_t &byte) {
+    if (offset >= packet_data.size()) {
+        return fail(DecodeStatus::Truncated);
     }
-    return packet_data[offset++];
+    byte = packet_data[offset++];
+    return true;
 }
 
-
-uint16_t PacketDataReader::read_uint16() {
+bool PacketDataReader::read_uint16(uint16_t &word) {
     if (offset + 2 > packet_data.size()) {
-        throw std::exception();
+        return fail(DecodeStatus::Truncated);
     }
     uint8_t msb = packet_data[offset++];
     uint8_t lsb = packet_data[offset++];
-    return (msb << 8) + lsb;
+    word = (msb << 8) + lsb;
+    return true;
 }
 
-std::string PacketDataReader::read_string() {
-    uint16_t len = read_uint16();
-    if (offset + len > packet_data.size()) {
-        throw std::exception();
+bool PacketDataReader::read_string(std::string &s) {
+    if (offset + 2 > packet_data.size()) {
+        return fail(DecodeStatus::Truncated);
     }
-    std::string s(&packet_data[offset], &packet_data[offset + len]);
-    offset += len;
-    return s;
+    size_t len = (packet_data[offset] << 8) + packet_data[offset + 1];
+    if (offset + 2 + len > packet_data.size()) {
+        return fail(DecodeStatus::TruncatedString);
+    }
+    s.assign(packet_data.data() + offset + 2, packet_data.data() + offset + 2 + len);
+    offset += 2 + len;
+    return true;
 }
 
-std::vector<uint8_t> PacketDataReader::read_bytes() {
-    uint16_t len = read_uint16();
-    if (offset + len > packet_data.size()) {
-        throw std::exception();
+bool PacketDataReader::read_bytes(std::vector<uint8_t> &b) {
+    if (offset + 2 > packet_data.size()) {
+        return fail(DecodeStatus::Truncated);
     }
-    std::vector<uint8_t> v(&packet_data[offset], &packet_data[offset + len]);
-    offset += len;
-    return v;
+    size_t len = (packet_data[offset] << 8) + packet_data[offset + 1];
+    if (offset + 2 + len > packet_data.size()) {
+        return fail(DecodeStatus::TruncatedString);
+    }
+    b.assign(packet_data.data() + offset + 2, packet_data.data() + offset + 2 + len);
+    offset += 2 + len;
+    return true;
 }
 
-std::vector<uint8_t> PacketDataReader::read_bytes(size_t len) {
+bool PacketDataReader::read_bytes(size_t len, std::vector<uint8_t> &b) {
     if (offset + len > packet_data.size()) {
-        throw std::exception();
+        return fail(DecodeStatus::TruncatedString);
     }
-    std::vector<uint8_t> v(&packet_data[offset], &packet_data[offset + len]);
+    b.assign(packet_data.data() + offset, packet_data.data() + offset + len);
     offset += len;
-    return v;
+    return true;
 }
 
 bool PacketDataReader::empty() {
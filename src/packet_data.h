@@ -14,10 +14,91 @@
 /** Typedef for packet data container. */
 typedef std::vector<uint8_t> packet_data_t;
 
+/**
+ * Enumeration constants for the result of decoding a control packet.
+ *
+ * Malformed packets are reported through these values rather than exceptions so a stream of bad packets, sent by a
+ * faulty or hostile client, is rejected without unwinding the stack for each one.
+ */
+enum class DecodeStatus : uint8_t {
+    /** The packet was decoded. */
+    Ok,
+    /** The remaining length is missing or longer than 4 bytes. */
+    MalformedLength,
+    /** The remaining length does not match the size of the packet. */
+    LengthMismatch,
+    /** The packet type is reserved or is not the type being decoded. */
+    BadType,
+    /** The fixed header flags are not the values required for the packet type. */
+    BadFlags,
+    /** The packet ends inside a fixed size field. */
+    Truncated,
+    /** A string or byte sequence runs past the end of the packet. */
+    TruncatedString,
+    /** A topic name or topic filter breaks the MQTT 3.1.1 topic rules. */
+    InvalidTopic,
+    /** The packet is larger than the receiver's maximum packet size. */
+    PacketTooLarge,
+};
+
+/**
+ * Name of a DecodeStatus value.
+ *
+ * @param status Decode status.
+ * @return       Constant string naming the status.
+ */
+const char *decode_status_name(DecodeStatus status);
+
+/**
+ * Non-owning view of serialized packet data.
+ *
+ * Packets are framed and parsed in place, directly from contiguous memory inside the network input buffer.  A view
+ * only remains valid until that memory is drained, deserialized packets copy out any field they must keep.  A
+ * packet_data_t container converts implicitly to a view of its contents.
+ */
+class PacketDataView
+{
+public:
+
+    /**
+     * Constructor
+     *
+     * @param data Pointer to the first byte.
+     * @param size Number of bytes.
+     */
+    PacketDataView(const uint8_t *data, size_t size) : view_data(data), view_size(size) {}
+
+    /**
+     * Constructor
+     *
+     * @param packet_data A reference to a packet_data_t container, which must outlive the view.
+     */
+    PacketDataView(const packet_data_t & packet_data) : view_data(packet_data.data()), view_size(packet_data.size()) {}
+
+    /** Pointer to the first byte. */
+    const uint8_t *data() const { return view_data; }
+
+    /** Number of bytes. */
+    size_t size() const { return view_size; }
+
+    /** Byte at an offset. */
+    uint8_t operator[](size_t i) const { return view_data[i]; }
+
+private:
+
+    /** Pointer to the first byte. */
+    const uint8_t *view_data;
+
+    /** Number of bytes. */
+    size_t view_size;
+};
+
 /**
  * Serialization class.
  *
- * Methods are provided to write native types to the MQTT 3.1.1 standard wire format.
+ * Methods are provided to write native types to the MQTT 3.1.1 standard wire format.  Data is written into memory
+ * preallocated by the caller, sized with the static size methods, so strings and byte sequences are copied in bulk
+ * and nothing is reallocated while writing.
  */
 class PacketDataWriter
 {
@@ -26,14 +107,36 @@ public:
     /**
      * Constructor
      *
-     * Accepts a reference to a packet_data_t container.  This container will be filled with serialized data and
-     * can be sent directly through the network connection.
+     * Accepts a pointer to preallocated memory, for example reserved space in a network output buffer.  The memory
+     * must be large enough to hold everything written.
+     *
+     * @param data Pointer to the memory to write.
+     */
+    PacketDataWriter(uint8_t * data) : offset(0), data(data) {}
+
+    /**
+     * Constructor
+     *
+     * Accepts a reference to a packet_data_t container.  Data is written from the start of the container which must
+     * already be sized to hold everything written.
      *
      * @param packet_data A reference to a packet_data_t container.
      */
-    PacketDataWriter(packet_data_t & packet_data) : packet_data(packet_data) {
-        packet_data.resize(0);
-    }
+    PacketDataWriter(packet_data_t & packet_data) : offset(0), data(packet_data.data()) {}
+
+    /**
+     * Number of bytes used to encode a remaining length value.
+     *
+     * @param length The value to encode.
+     * @return       Encoded size from 1 to 4 bytes.
+     */
+    static size_t remaining_length_size(size_t length);
+
+    /** Number of bytes used to encode a UTF-8 character string. */
+    static size_t string_size(const std::string & s) { return 2 + s.size(); }
+
+    /** Number of bytes used to encode a length prefixed byte sequence. */
+    static size_t bytes_size(const packet_data_t & b) { return 2 + b.size(); }
 
     /**
      * Write the integer length to the container using the MQTT 3.1.1 remaining length encoding scheme.
@@ -42,22 +145,35 @@ public:
      */
     void write_remaining_length(size_t length);
 
-    /** Write a byte to the packet_data_t container. */
+    /** Write a byte. */
     void write_byte(uint8_t byte);
 
-    /** Write a 16 bit value to the packet_data_t container. */
+    /** Write a 16 bit value. */
     void write_uint16(uint16_t word);
 
-    /** Write a UTF-8 character string to the packet_data_t container. */
+    /** Write a UTF-8 character string. */
     void write_string(const std::string & s);
 
-    /** Copy the contents of a packet_data_t container into this instance's container. */
+    /** Write a byte sequence preceded by its length. */
     void write_bytes(const packet_data_t & b);
 
+    /** Write a byte sequence without a length, such as a publish payload. */
+    void write_raw(const uint8_t * b, size_t len);
+
+    /**
+     * Return the number of bytes written.
+     *
+     * @return integer.
+     */
+    size_t get_offset() const { return offset; }
+
 private:
 
-    /** A reference to the packet_data_t container. */
-    packet_data_t & packet_data;
+    /** Current write offset. */
+    size_t offset;
+
+    /** Pointer to the memory written. */
+    uint8_t * data;
 };
 
 /**
@@ -74,13 +190,13 @@ public:
     /**
      * Constructor
      *
-     * Accepts a reference to a packet_data_t container that contains data received directly over a network connection.
-     * The class also contains a current offset pointer that is initialized to point to the beginning of the container.
-     * Each data read will advance the offset pointer forward to the next item in the container.
+     * Accepts a view of data received directly over a network connection.  The class also contains a current offset
+     * pointer that is initialized to point to the beginning of the view.  Each data read will advance the offset
+     * pointer forward to the next item in the view.
      *
-     * @param packet_data A reference to a packet_data_t container.
+     * @param packet_data A view of the packet data, a packet_data_t container may be passed directly.
      */
-    PacketDataReader(const packet_data_t & packet_data) : offset(0), packet_data(packet_data) {}
+    PacketDataReader(const PacketDataView & packet_data) : offset(0), packet_data(packet_data) {}
 
     /**
      * Is a remaing lenght value present.
@@ -95,6 +211,8 @@ public:
     /**
      * Read the remaining length value from the packet_data_t container.
      *
+     * Throwing wrapper of the checked read.
+     *
      * @return integer.
      */
     size_t read_remaining_length();
@@ -140,6 +258,39 @@ public:
      */
     std::vector<uint8_t> read_bytes(size_t len);
 
+    /**
+     * Checked reads.
+     *
+     * Each method stores the value read in its argument and returns true, or records the failure in the reader status
+     * and returns false without throwing.  The offset is not advanced by a failed read.  The throwing methods above
+     * wrap these.
+     */
+
+    /** Read the remaining length value. */
+    bool read_remaining_length(size_t & length);
+
+    /** Read a single byte. */
+    bool read_byte(uint8_t & byte);
+
+    /** Read a 16 bit value. */
+    bool read_uint16(uint16_t & word);
+
+    /** Read a UTF-8 encoded string. */
+    bool read_string(std::string & s);
+
+    /** Read a byte sequence preceded by its length. */
+    bool read_bytes(std::vector<uint8_t> & b);
+
+    /** Read a byte sequence of a given length. */
+    bool read_bytes(size_t len, std::vector<uint8_t> & b);
+
+    /**
+     * Status of the first failed read.
+     *
+     * @return DecodeStatus::Ok if no read has failed.
+     */
+    DecodeStatus get_status() const { return status; }
+
     /**
      * Is the packet_data_t container empty.
      *
@@ -155,17 +306,33 @@ public:
     size_t get_offset() { return offset; }
 
     /**
-     * Get a reference to the packet_data_t container.
+     * Get the view of the packet data.
      *
-     * @return Reference to packet_data_t container.
+     * @return Reference to the packet data view.
      */
-    const packet_data_t & get_packet_data() { return packet_data; }
+    const PacketDataView & get_packet_data() { return packet_data; }
 
 private:
 
     /** Current packet_data_t container offset pointer */
     size_t offset;
 
-    /** Packet data container. */
-    const packet_data_t & packet_data;
+    /** Packet data view. */
+    PacketDataView packet_data;
+
+    /** Status of the first failed read. */
+    DecodeStatus status = DecodeStatus::Ok;
+
+    /**
+     * Record a failed read.
+     *
+     * @param failure Reason for the failure.
+     * @return        Always false, for returning from checked reads.
+     */
+    bool fail(DecodeStatus failure) {
+        if (status == DecodeStatus::Ok) {
+            status = failure;
+        }
+        return false;
+    }
 };
@@ -0,0 +1,79 @@
+/**
+ * @file packet_dispatch.cc
+ */
+
+#include "packet_dispatch.h"
+
+/**
+ * Operations on a packet of one type.
+ */
+struct PacketOps {
+
+    /** Decode a packet into an arena. */
+    DecodeStatus (*create)(const PacketDataView &packet_data, PacketArena &arena, const Packet *&packet);
+
+    /** Pass a packet of this type to its handler method. */
+    void (*dispatch)(const Packet &packet, PacketHandler &handler);
+};
+
+template<typename PacketT, void (PacketHandler::*Handle)(const PacketT &)>
+struct PacketTypeOps {
+
+    static DecodeStatus create(const PacketDataView &packet_data, PacketArena &arena, const Packet *&packet) {
+        PacketT *decoded = arena.create<PacketT>();
+        DecodeStatus status = decoded->decode(packet_data);
+        if (status == DecodeStatus::Ok) {
+            packet = decoded;
+        }
+        return status;
+    }
+
+    static void dispatch(const Packet &packet, PacketHandler &handler) {
+        (handler.*Handle)(static_cast<const PacketT &>(packet));
+    }
+
+    static constexpr PacketOps ops() {
+        return PacketOps{create, dispatch};
+    }
+};
+
+/** Operations indexed by packet type, the reserved types 0 and 15 have none. */
+static const PacketOps packet_ops[16] = {
+        {nullptr, nullptr},
+        PacketTypeOps<ConnectPacket, &PacketHandler::handle_connect>::ops(),
+        PacketTypeOps<ConnackPacket, &PacketHandler::handle_connack>::ops(),
+        PacketTypeOps<PublishPacket, &PacketHandler::handle_publish>::ops(),
+        PacketTypeOps<PubackPacket, &PacketHandler::handle_puback>::ops(),
+        PacketTypeOps<PubrecPacket, &PacketHandler::handle_pubrec>::ops(),
+        PacketTypeOps<PubrelPacket, &PacketHandler::handle_pubrel>::ops(),
+        PacketTypeOps<PubcompPacket, &PacketHandler::handle_pubcomp>::ops(),
+        PacketTypeOps<SubscribePacket, &PacketHandler::handle_subscribe>::ops(),
+        PacketTypeOps<SubackPacket, &PacketHandler::handle_suback>::ops(),
+        PacketTypeOps<UnsubscribePacket, &PacketHandler::handle_unsubscribe>::ops(),
+        PacketTypeOps<UnsubackPacket, &PacketHandler::handle_unsuback>::ops(),
+        PacketTypeOps<PingreqPacket, &PacketHandler::handle_pingreq>::ops(),
+        PacketTypeOps<PingrespPacket, &PacketHandler::handle_pingresp>::ops(),
+        PacketTypeOps<DisconnectPacket, &PacketHandler::handle_disconnect>::ops(),
+        {nullptr, nullptr},
+};
+
+DecodeStatus decode_packet(const PacketDataView &packet_data, PacketArena &arena, const Packet *&packet) {
+
+    packet = nullptr;
+
+    if (packet_data.size() == 0) {
+        return DecodeStatus::Truncated;
+    }
+
+    const PacketOps &ops = packet_ops[packet_data[0] >> 4];
+
+    if (!ops.create) {
+        return DecodeStatus::BadType;
+    }
+
+    return ops.create(packet_data, arena, packet);
+}
+
+void dispatch_packet(const Packet &packet, PacketHandler &handler) {
+    packet_ops[static_cast<uint8_t>(packet.type) & 0x0F].dispatch(packet, handler);
+}
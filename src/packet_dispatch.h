@@ -0,0 +1,130 @@
+/**
+ * @file packet_dispatch.h
+ *
+ * Tag dispatched decoding and handling of control packets.
+ *
+ * The control packet type is carried in the first byte of every packet.  Decoding and handling are driven by a table
+ * indexed by that type, built at compile time, so a received packet is decoded into a PacketArena and passed to the
+ * handler method for its type without a heap allocation or a dynamic_cast.
+ */
+
+#pragma once
+
+#include "packet.h"
+#include "packet_arena.h"
+
+struct evbuffer;
+
+/**
+ * Packet handler interface.
+ *
+ * Receives decoded control packets, one method per packet type.  BaseSession implements this interface with its
+ * handle_* methods, so session classes overriding those methods receive packets from the dispatch table unchanged.
+ */
+class PacketHandler {
+public:
+
+    virtual ~PacketHandler() {}
+
+    virtual void handle_connect(const ConnectPacket & connect_packet) = 0;
+
+    virtual void handle_connack(const ConnackPacket & connack_packet) = 0;
+
+    virtual void handle_publish(const PublishPacket & publish_packet) = 0;
+
+    virtual void handle_puback(const PubackPacket & puback_packet) = 0;
+
+    virtual void handle_pubrec(const PubrecPacket & pubrec_packet) = 0;
+
+    virtual void handle_pubrel(const PubrelPacket & pubrel_packet) = 0;
+
+    virtual void handle_pubcomp(const PubcompPacket & pubcomp_packet) = 0;
+
+    virtual void handle_subscribe(const SubscribePacket & subscribe_packet) = 0;
+
+    virtual void handle_suback(const SubackPacket & suback_packet) = 0;
+
+    virtual void handle_unsubscribe(const UnsubscribePacket & unsubscribe_packet) = 0;
+
+    virtual void handle_unsuback(const UnsubackPacket & unsuback_packet) = 0;
+
+    virtual void handle_pingreq(const PingreqPacket & pingreq_packet) = 0;
+
+    virtual void handle_pingresp(const PingrespPacket & pingresp_packet) = 0;
+
+    virtual void handle_disconnect(const DisconnectPacket & disconnect_packet) = 0;
+
+    /**
+     * Called after the handler method for each dispatched packet returns.
+     *
+     * The default does nothing.
+     */
+    virtual void packet_dispatched() {}
+
+    /**
+     * Called once every packet of a batch has been dispatched.
+     *
+     * The PacketManager frames every complete packet received in one read before dispatching them as a batch, so work
+     * that does not need to follow each packet, such as flushing pending messages, is done here once per read.  Only
+     * the handler installed when the batch ends is called.  The default does nothing.
+     *
+     * @param packet_count Number of packets in the batch.
+     */
+    virtual void batch_dispatched(size_t packet_count) {}
+
+    /**
+     * Offered a publish whose payload can be streamed.
+     *
+     * Called by a PacketManager with a stream threshold once the headers of a publish of at least that size have
+     * arrived, ahead of its payload.  Accepting the stream passes the payload to handle_publish_stream_data as it
+     * arrives, then calls handle_publish_stream_end and packet_dispatched, and the publish is never passed to
+     * handle_publish.  Declining buffers the packet and dispatches it as usual.  The default declines.
+     *
+     * @param header         Reference to the publish, its message holds the topic name and an empty payload.
+     * @param payload_length Length of the payload to follow.
+     * @return               The payload is streamed.
+     */
+    virtual bool handle_publish_stream_begin(const PublishPacket &header, size_t payload_length) { return false; }
+
+    /**
+     * Called with each part of a streamed payload as it arrives.
+     *
+     * @param chunk Pointer to a buffer holding the part.  It may be copied or referenced, it is drained on return.
+     */
+    virtual void handle_publish_stream_data(struct evbuffer *chunk) {}
+
+    /**
+     * Called once the whole payload of a streamed publish has been received.
+     */
+    virtual void handle_publish_stream_end() {}
+
+    /**
+     * Called when the connection fails before the whole payload of a streamed publish has been received.
+     *
+     * Called ahead of the PacketManager event handler and must not destroy the PacketManager.
+     */
+    virtual void handle_publish_stream_abort() {}
+};
+
+/**
+ * Decode a complete control packet into an arena.
+ *
+ * Malformed packets are reported without throwing.
+ *
+ * @param packet_data View of the packet data.
+ * @param arena       Reference to the arena holding the packet.
+ * @param packet      Set to the packet, valid until the arena is reset, or nullptr if the packet is not decoded.
+ * @return            DecodeStatus::Ok, or the reason the packet is malformed.
+ */
+DecodeStatus decode_packet(const PacketDataView & packet_data, PacketArena & arena, const Packet *& packet);
+
+/**
+ * Pass a decoded packet to the handler method for its type.
+ *
+ * Adapter for packets decoded by other means, such as decode_packet.  The table selects the handler so no
+ * dynamic_cast is needed.
+ *
+ * @param packet  Reference to the packet.
+ * @param handler Reference to the handler.
+ */
+void dispatch_packet(const Packet & packet, PacketHandler & handler);
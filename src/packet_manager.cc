@@ -10,128 +10,476 @@
 
 #include <cstring>
 
+const size_t PacketManager::ReferenceThreshold;
+
+PacketManager::~PacketManager() {
+    if (destroyed_flag) {
+        *destroyed_flag = true;
+    }
+    if (output_stream) {
+        output_stream->packet_manager = nullptr;
+    }
+    if (bev) {
+        bufferevent_free(bev);
+        bev = nullptr;
+    }
+    if (stream_chunk) {
+        evbuffer_free(stream_chunk);
+    }
+    if (deferred_output) {
+        evbuffer_free(deferred_output);
+    }
+}
+
 void PacketManager::receive_packet_data() {
 
+    bool destroyed = false;
+    destroyed_flag = &destroyed;
+
+    dispatch_packets(destroyed);
+
+    if (destroyed) {
+        return;
+    }
+
+    destroyed_flag = nullptr;
+
+    // Every packet decoded in this callback has been dispatched
+    arena.reset();
+}
+
+void PacketManager::dispatch_packets(const bool &destroyed) {
+
+    while (bev) {
+
+        if (stream_handler) {
+            stream_input(destroyed);
+            if (destroyed or !bev or stream_handler) {
+                return;
+            }
+            continue;
+        }
+
+        DecodeStatus status = frame_packets();
+
+        if (!batch.empty()) {
+            dispatch_batch(destroyed);
+            if (destroyed or !bev) {
+                return;
+            }
+        }
+
+        if (status == DecodeStatus::Ok) {
+            // Packets ahead of a publish to be streamed have been dispatched, the publish is offered next
+            if (stream_pending and begin_input_stream(destroyed)) {
+                continue;
+            }
+            return;
+        }
+
+        // The malformed packet has been drained, or is being discarded, framing resumes after it
+        if (event_handler) {
+            bool too_large = status == DecodeStatus::PacketTooLarge;
+            event_handler(too_large ? EventType::PacketTooLarge : EventType::ProtocolError);
+            if (destroyed) {
+                return;
+            }
+        }
+    }
+}
+
+DecodeStatus PacketManager::frame_packets() {
+
     struct evbuffer *input = bufferevent_get_input(bev);
 
+    batch.clear();
+    stream_pending = false;
+
     while (evbuffer_get_length(input) != 0) {
 
         size_t available = evbuffer_get_length(input);
 
+        if (discard_length != 0) {
+            size_t discard = std::min(available, discard_length);
+            evbuffer_drain(input, discard);
+            discard_length -= discard;
+            continue;
+        }
+
         if (available < 2) {
-            return;
+            break;
         }
 
         if (fixed_header_length == 0) {
 
-            size_t peek_size = std::min<uint8_t>(static_cast<uint8_t>(available), 5);
+            // The fixed header is at most 5 bytes.  It is read in place when the first chain of the input buffer
+            // holds it and only copied to the stack when it straddles two chains.
+            size_t peek_size = std::min<size_t>(available, 5);
+            uint8_t header[5];
+            const uint8_t *header_data = header;
 
-            std::vector<uint8_t> peek_buffer(peek_size);
-            evbuffer_copyout(input, &peek_buffer[0], peek_size);
+            struct evbuffer_iovec extent;
+            if (evbuffer_peek(input, peek_size, nullptr, &extent, 1) >= 1 and extent.iov_len >= peek_size) {
+                header_data = static_cast<const uint8_t *>(extent.iov_base);
+            } else {
+                evbuffer_copyout(input, header, peek_size);
+            }
 
-            PacketDataReader reader(peek_buffer);
+            PacketDataView header_view(header_data, peek_size);
+            PacketDataReader reader(header_view);
             reader.read_byte();
             if (!reader.has_remaining_length()) {
                 if (peek_size == 5) {
-                    if (event_handler) {
-                        event_handler(EventType::ProtocolError);
-                    }
                     evbuffer_drain(input, peek_size);
+                    return DecodeStatus::MalformedLength;
                 }
-                return;
+                break;
             }
 
             remaining_length = reader.read_remaining_length();
             fixed_header_length = reader.get_offset();
 
+            if (max_packet_size != 0 and fixed_header_length + remaining_length > max_packet_size) {
+                discard_length = fixed_header_length + remaining_length;
+                fixed_header_length = 0;
+                remaining_length = 0;
+                return DecodeStatus::PacketTooLarge;
+            }
         }
 
         size_t packet_size = fixed_header_length + remaining_length;
 
+        if (stream_threshold != 0 and packet_size >= stream_threshold and packet_handler and !stream_declined) {
+            uint8_t command_header;
+            evbuffer_copyout(input, &command_header, 1);
+            if (static_cast<PacketType>(command_header >> 4) == PacketType::Publish) {
+                stream_pending = true;
+                break;
+            }
+        }
+
         if (available < packet_size) {
-            return;
+            break;
         }
 
-        packet_data_t packet_data(packet_size);
-        evbuffer_remove(input, &packet_data[0], packet_size);
+        // Parse the packet where it lies in the input buffer.  Pulling up only moves data when the packet spans more
+        // than one chain.  Decoded packets hold copies of their fields so the packet is drained straight away.
+        const uint8_t *packet_data = evbuffer_pullup(input, packet_size);
 
         fixed_header_length = 0;
         remaining_length = 0;
+        stream_declined = false;
 
-        std::unique_ptr<Packet> packet = parse_packet_data(packet_data);
+        const Packet *packet;
+        DecodeStatus status = decode_packet(PacketDataView(packet_data, packet_size), arena, packet);
 
-        if (packet && packet_received_handler) {
-            packet_received_handler(std::move(packet));
+        evbuffer_drain(input, packet_size);
+
+        if (status != DecodeStatus::Ok) {
+            return status;
         }
+
+        batch.push_back(packet);
     }
+
+    return DecodeStatus::Ok;
 }
 
-std::unique_ptr<Packet> PacketManager::parse_packet_data(const std::vector<uint8_t> &packet_data) {
+void PacketManager::dispatch_batch(const bool &destroyed) {
 
-    PacketType type = static_cast<PacketType>(packet_data[0] >> 4);
+    batch_count++;
+    packet_count += batch.size();
 
-    std::unique_ptr<Packet> packet;
+    for (const Packet *packet : batch) {
 
-    try {
-        switch (type) {
-            case PacketType::Connect:
-                packet = std::unique_ptr<ConnectPacket>(new ConnectPacket(packet_data));
-                break;
-            case PacketType::Connack:
-                packet = std::unique_ptr<ConnackPacket>(new ConnackPacket(packet_data));
-                break;
-            case PacketType::Publish:
-                packet = std::unique_ptr<PublishPacket>(new PublishPacket(packet_data));
-                break;
-            case PacketType::Puback:
-                packet = std::unique_ptr<PubackPacket>(new PubackPacket(packet_data));
-                break;
-            case PacketType::Pubrec:
-                packet = std::unique_ptr<PubrecPacket>(new PubrecPacket(packet_data));
-                break;
-            case PacketType::Pubrel:
-                packet = std::unique_ptr<PubrelPacket>(new PubrelPacket(packet_data));
-                break;
-            case PacketType::Pubcomp:
-                packet = std::unique_ptr<PubcompPacket>(new PubcompPacket(packet_data));
-                break;
-            case PacketType::Subscribe:
-                packet = std::unique_ptr<SubscribePacket>(new SubscribePacket(packet_data));
-                break;
-            case PacketType::Suback:
-                packet = std::unique_ptr<SubackPacket>(new SubackPacket(packet_data));
-                break;
-            case PacketType::Unsubscribe:
-                packet = std::unique_ptr<UnsubscribePacket>(new UnsubscribePacket(packet_data));
-                break;
-            case PacketType::Unsuback:
-                packet = std::unique_ptr<UnsubackPacket>(new UnsubackPacket(packet_data));
-                break;
-            case PacketType::Pingreq:
-                packet = std::unique_ptr<PingreqPacket>(new PingreqPacket(packet_data));
-                break;
-            case PacketType::Pingresp:
-                packet = std::unique_ptr<PingrespPacket>(new PingrespPacket(packet_data));
-                break;
-            case PacketType::Disconnect:
-                packet = std::unique_ptr<DisconnectPacket>(new DisconnectPacket(packet_data));
-                break;
+        if (packet_handler) {
+            // The handler may be replaced while handling the packet, when a session is resumed, and the handler that
+            // received the packet is the one told it was dispatched
+            PacketHandler *handler = packet_handler;
+            dispatch_packet(*packet, *handler);
+            handler->packet_dispatched();
+        } else if (packet_received_handler) {
+            packet_received_handler(*packet);
         }
-    } catch (std::exception &e) {
-        if (event_handler) {
-            event_handler(EventType::ProtocolError);
+
+        if (destroyed or !bev) {
+            return;
+        }
+    }
+
+    if (packet_handler) {
+        packet_handler->batch_dispatched(batch.size());
+    }
+}
+
+bool PacketManager::begin_input_stream(const bool &destroyed) {
+
+    struct evbuffer *input = bufferevent_get_input(bev);
+    size_t available = evbuffer_get_length(input);
+    size_t packet_size = fixed_header_length + remaining_length;
+
+    // The variable header is the topic name, and a packet id above QoS 0, both needed to route the message
+    if (available < fixed_header_length + 2) {
+        return false;
+    }
+
+    uint8_t header[5 + 2];
+    evbuffer_copyout(input, header, fixed_header_length + 2);
+    size_t header_length = fixed_header_length + 2 + ((header[fixed_header_length] << 8) |
+                                                      header[fixed_header_length + 1]);
+    if (((header[0] >> 1) & 0x03) != 0) {
+        header_length += 2;
+    }
+
+    // A header overrunning the packet is left for the decoder to report once the packet is complete
+    if (header_length > packet_size) {
+        stream_declined = true;
+        return true;
+    }
+
+    if (available < header_length) {
+        return false;
+    }
+
+    PublishPacket publish_packet;
+    size_t payload_length = 0;
+
+    const uint8_t *header_data = evbuffer_pullup(input, header_length);
+    if (publish_packet.decode_header(PacketDataView(header_data, header_length), payload_length) != DecodeStatus::Ok) {
+        stream_declined = true;
+        return true;
+    }
+
+    PacketHandler *handler = packet_handler;
+    bool accepted = handler->handle_publish_stream_begin(publish_packet, payload_length);
+    if (destroyed or !bev) {
+        return false;
+    }
+
+    if (!accepted) {
+        stream_declined = true;
+        return true;
+    }
+
+    evbuffer_drain(input, header_length);
+    fixed_header_length = 0;
+    remaining_length = 0;
+
+    stream_handler = handler;
+    stream_remaining = payload_length;
+    if (!stream_chunk) {
+        stream_chunk = evbuffer_new();
+    }
+
+    return true;
+}
+
+void PacketManager::stream_input(const bool &destroyed) {
+
+    struct evbuffer *input = bufferevent_get_input(bev);
+    size_t length = std::min(evbuffer_get_length(input), stream_remaining);
+
+    // Chains are moved out of the input buffer, the handler can reference them without copying
+    if (length != 0) {
+        evbuffer_remove_buffer(input, stream_chunk, length);
+        stream_remaining -= length;
+        stream_handler->handle_publish_stream_data(stream_chunk);
+        if (destroyed) {
+            return;
         }
+        evbuffer_drain(stream_chunk, evbuffer_get_length(stream_chunk));
+        if (!bev) {
+            return;
+        }
+    }
+
+    if (stream_remaining == 0) {
+        PacketHandler *handler = stream_handler;
+        stream_handler = nullptr;
+        packet_count++;
+        handler->handle_publish_stream_end();
+        if (destroyed) {
+            return;
+        }
+        handler->packet_dispatched();
+    }
+}
+
+struct evbuffer *PacketManager::output_buffer() {
+    if (!bev or output_failed) {
+        return nullptr;
+    }
+    return output_stream ? deferred_output : bufferevent_get_output(bev);
+}
+
+std::unique_ptr<OutputStream> PacketManager::open_output_stream(const PublishPacket &header, size_t payload_length) {
+
+    struct evbuffer *output = output_buffer();
+    if (!output or output_stream) {
+        return nullptr;
+    }
+
+    size_t header_size = header.header_size(payload_length);
+
+    struct evbuffer_iovec extent;
+    if (evbuffer_reserve_space(output, header_size, &extent, 1) < 1) {
+        fail_connection(EventType::NetworkError);
+        return nullptr;
+    }
+
+    header.encode_header_to(static_cast<uint8_t *>(extent.iov_base), payload_length);
+
+    extent.iov_len = header_size;
+    evbuffer_commit_space(output, &extent, 1);
+
+    if (!deferred_output) {
+        deferred_output = evbuffer_new();
+    }
+
+    std::unique_ptr<OutputStream> stream(new OutputStream(this, payload_length));
+    output_stream = stream.get();
+    return stream;
+}
+
+void PacketManager::end_output_stream(bool complete) {
+
+    output_stream->packet_manager = nullptr;
+    output_stream = nullptr;
+
+    if (bev and complete) {
+        evbuffer_add_buffer(bufferevent_get_output(bev), deferred_output);
+        return;
+    }
+
+    evbuffer_drain(deferred_output, evbuffer_get_length(deferred_output));
+
+    fail_connection(EventType::StreamAborted);
+}
+
+void PacketManager::fail_connection(EventType event) {
+
+    if (!bev or output_failed) {
+        return;
+    }
+
+    output_failed = true;
+    output_failure = event;
+    bufferevent_disable(bev, EV_READ);
+    bufferevent_trigger_event(bev, BEV_EVENT_ERROR, BEV_TRIG_DEFER_CALLBACKS);
+}
+
+void OutputStream::write(struct evbuffer *chunk) {
+
+    if (!packet_manager) {
+        return;
+    }
+
+    size_t length = evbuffer_get_length(chunk);
+    if (length > remaining) {
+        abort();
+        return;
+    }
+    remaining -= length;
+
+    if (packet_manager->bev and
+        evbuffer_add_buffer_reference(bufferevent_get_output(packet_manager->bev), chunk) != 0) {
+        abort();
+    }
+}
+
+void OutputStream::close() {
+    if (packet_manager) {
+        packet_manager->end_output_stream(remaining == 0);
+    }
+}
+
+void OutputStream::abort() {
+    if (packet_manager) {
+        packet_manager->end_output_stream(false);
     }
-    return packet;
 }
 
 void PacketManager::send_packet(const Packet &packet) {
-    std::vector<uint8_t> packet_data = packet.serialize();
-    if (bev) {
-        bufferevent_write(bev, &packet_data[0], packet_data.size());
-    } else {
+    if (packet.type == PacketType::Publish) {
+        send_publish(static_cast<const PublishPacket &>(packet));
+        return;
+    }
+
+    struct evbuffer *output = output_buffer();
+    if (!output) {
         std::cout << "not writing to closed bev\n";
+        return;
+    }
+
+    // Encode straight into reserved output buffer space
+    size_t encoded_size = packet.encoded_size();
+
+    struct evbuffer_iovec extent;
+    if (evbuffer_reserve_space(output, encoded_size, &extent, 1) < 1) {
+        fail_connection(EventType::NetworkError);
+        return;
     }
+
+    packet.encode_to(static_cast<uint8_t *>(extent.iov_base));
+
+    extent.iov_len = encoded_size;
+    evbuffer_commit_space(output, &extent, 1);
+}
+
+void PacketManager::send_publish(const PublishPacket &packet) {
+
+    // Deliveries to a closed or failed connection are dropped, the event handler reports the failure
+    struct evbuffer *output = output_buffer();
+    if (!output) {
+        return;
+    }
+
+    bool has_packet_id = packet.qos() != QoSType::QoS0;
+    const packet_data_t &wire_header = packet.message->wire_header(has_packet_id);
+    const std::vector<uint8_t> &payload = packet.message->payload;
+
+    bool reference_payload = payload.size() >= ReferenceThreshold;
+    size_t copy_size = wire_header.size() + (reference_payload ? 0 : payload.size());
+
+    // Copy the header, and a small payload, into the output buffer and patch the per delivery bytes in place
+    struct evbuffer_iovec extent;
+    if (evbuffer_reserve_space(output, copy_size, &extent, 1) < 1) {
+        fail_connection(EventType::NetworkError);
+        return;
+    }
+
+    uint8_t *header = static_cast<uint8_t *>(extent.iov_base);
+    std::memcpy(header, wire_header.data(), wire_header.size());
+    header[0] |= packet.header_flags & 0x0F;
+
+    if (has_packet_id) {
+        size_t offset = packet.packet_id_offset(wire_header);
+        header[offset] = (packet.packet_id >> 8) & 0xFF;
+        header[offset + 1] = packet.packet_id & 0xFF;
+    }
+
+    if (!reference_payload) {
+        std::memcpy(header + wire_header.size(), payload.data(), payload.size());
+    }
+
+    extent.iov_len = copy_size;
+    evbuffer_commit_space(output, &extent, 1);
+
+    if (!reference_payload) {
+        return;
+    }
+
+    // The output buffer refers to the payload of the message and holds the message until the bytes are written
+    std::shared_ptr<const Message> *message = new std::shared_ptr<const Message>(packet.message);
+    if (evbuffer_add_reference(output, payload.data(), payload.size(), release_message, message) != 0) {
+        // The header is already in the output buffer, the packet can not be completed
+        delete message;
+        fail_connection(EventType::NetworkError);
+    }
+}
+
+void PacketManager::release_message(const void *data, size_t length, void *arg) {
+    delete static_cast<std::shared_ptr<const Message> *>(arg);
 }
 
 void PacketManager::close_connection() {
@@ -141,17 +489,38 @@ void PacketManager::close_connection() {
         bufferevent_free(bev);
         bev = nullptr;
     }
+    stream_handler = nullptr;
+    stream_remaining = 0;
+}
+
+void PacketManager::set_max_packet_size(size_t size) {
+
+    max_packet_size = size;
+
+    // Reading stops once the input buffer holds a maximum size packet, which is always enough to complete the packet
+    // being framed since complete packets are drained as they are dispatched
+    if (bev) {
+        bufferevent_setwatermark(bev, EV_READ, 0, size);
+    }
 }
 
 void PacketManager::handle_events(short events) {
 
+    // The publish being streamed will not be completed, the handler hears of it before the event
+    if (stream_handler and (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT))) {
+        PacketHandler *handler = stream_handler;
+        stream_handler = nullptr;
+        stream_remaining = 0;
+        handler->handle_publish_stream_abort();
+    }
+
     if (events & BEV_EVENT_EOF) {
         if (event_handler) {
             event_handler(EventType::ConnectionClosed);
         }
     } else if (events & BEV_EVENT_ERROR) {
         if (event_handler) {
-            event_handler(EventType::NetworkError);
+            event_handler(output_failed ? output_failure : EventType::NetworkError);
         }
     } else if (events & BEV_EVENT_TIMEOUT) {
         if (event_handler) {
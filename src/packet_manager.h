@@ -14,6 +14,8 @@
 #pragma once
 
 #include "packet.h"
+#include "packet_dispatch.h"
+#include "packet_arena.h"
 
 #include <event2/event.h>
 #include <event2/bufferevent.h>
@@ -23,6 +25,71 @@
 #include <cstddef>
 #include <memory>
 
+class PacketManager;
+
+/**
+ * OutputStream class.
+ *
+ * Writes the payload of one publish to a PacketManager output buffer as it becomes available, see
+ * PacketManager::open_output_stream.  The packet headers are written when the stream is opened and announce the whole
+ * payload, so once opened the stream must either be completed or the connection failed.
+ */
+class OutputStream {
+public:
+
+    /**
+     * Destructor
+     *
+     * A stream destroyed before close is aborted.
+     */
+    ~OutputStream() { abort(); }
+
+    OutputStream(const OutputStream &) = delete;
+
+    OutputStream &operator=(const OutputStream &) = delete;
+
+    /**
+     * Write the next part of the payload.
+     *
+     * The output buffer references the chains of the chunk rather than copying them, so one chunk can be written to
+     * any number of streams.
+     *
+     * @param chunk Pointer to a buffer holding the part, left unchanged.
+     */
+    void write(struct evbuffer *chunk);
+
+    /**
+     * End the stream once the whole payload has been written.
+     *
+     * Packets sent through the PacketManager while the stream was open follow the publish.  A stream closed short of
+     * its payload is aborted.
+     */
+    void close();
+
+    /**
+     * Abandon the stream.
+     *
+     * The publish written so far can not be completed and the connection is failed, see PacketManager::EventType.
+     */
+    void abort();
+
+    /** The PacketManager still exists and the stream has not been closed or aborted. */
+    bool attached() const { return packet_manager != nullptr; }
+
+private:
+
+    friend class PacketManager;
+
+    OutputStream(PacketManager *packet_manager, size_t payload_length) : packet_manager(packet_manager),
+                                                                         remaining(payload_length) {}
+
+    /** PacketManager written to, nullptr once detached. */
+    PacketManager *packet_manager;
+
+    /** Payload bytes not yet written. */
+    size_t remaining;
+};
+
 /**
  * PacketManager class.
  *
@@ -34,7 +101,9 @@ public:
     /**
      * Enumeration constants for PacketManager events.
      *
-     * Events are low level network events or unrecoverable protocol errors.
+     * Events are low level network events or unrecoverable protocol errors.  PacketTooLarge is reported when a packet
+     * larger than the maximum packet size starts to arrive, the packet is discarded.  StreamAborted is reported when
+     * an output stream is aborted, the connection holds part of a publish that will never be completed.
      *
      */
     enum class EventType {
@@ -42,8 +111,17 @@ public:
         ProtocolError,
         ConnectionClosed,
         Timeout,
+        PacketTooLarge,
+        StreamAborted,
     };
 
+    /**
+     * Smallest publish payload referenced from the output buffer rather than copied into it.
+     *
+     * Below this size copying is cheaper than the extra buffer chain and message reference.
+     */
+    const static size_t ReferenceThreshold = 1024;
+
     /**
      * Constructor
      *
@@ -64,18 +142,15 @@ public:
      * Will free the bufferevent pointer.  This call should also close any underlying socket connection provided
      * the libevent flag LEV_OPT_CLOSE_ON_FREE was used to create the bufferevent.
      */
-    ~PacketManager() {
-        if (bev) {
-            bufferevent_free(bev);
-            bev = nullptr;
-        }
-    }
+    ~PacketManager();
 
     /**
      * Send a control packet through the network connection.
      *
      * This method is invoked by containing session instances when they want to send a control packet.  The packet
-     * will be serialized and transmitted provided the underlying socket connection is not closed.
+     * will be encoded directly into the output buffer and transmitted provided the underlying socket connection is not
+     * closed.  Publish packets are sent from the wire header and payload of their message, see send_publish.  If the
+     * output buffer can not take the packet the connection fails with a NetworkError event.
      */
     void send_packet(const Packet &);
 
@@ -91,16 +166,83 @@ public:
     /**
      * Set the packet received callback.
      *
-     * This callback will be invoked when a packet is received from the network and deserialized.  The callback will
-     * assume ownership of the packet memory.  A pointer to the base packet type is passed and the actual packet can
-     * be recovered through a dynamic_cast<>().
+     * This callback will be invoked when a packet is received from the network and deserialized.  The packet is
+     * borrowed from the packet arena and only valid until the read callback that decoded it finishes dispatching, a
+     * callback retaining the packet must copy it.  A reference to the base packet type is passed and the actual packet
+     * can be recovered through a dynamic_cast<>().
      *
      * @param handler Callback function.
      */
-    void set_packet_received_handler(std::function<void(std::unique_ptr<Packet>)> handler) {
+    void set_packet_received_handler(std::function<void(const Packet &)> handler) {
         packet_received_handler = handler;
+        packet_handler = nullptr;
     }
 
+    /**
+     * Set the packet handler.
+     *
+     * Received packets are decoded into the packet arena and passed to the handler method for their type through the
+     * dispatch table in packet_dispatch.h, avoiding the dynamic_cast of the packet received callback, which this
+     * replaces.  Packets are borrowed as for the callback.  The handler is not owned and must outlive this
+     * PacketManager or be replaced.
+     *
+     * @param handler Pointer to the handler.
+     */
+    void set_packet_handler(PacketHandler *handler) {
+        packet_handler = handler;
+        packet_received_handler = nullptr;
+    }
+
+    /**
+     * Set the maximum size of a received packet.
+     *
+     * The size is checked as soon as the fixed header of a packet is received.  A larger packet is not buffered, its
+     * bytes are drained from the input buffer as they arrive and a PacketTooLarge event is reported.  The limit is
+     * also the bufferevent read high watermark, so no more than one maximum size packet is read ahead of dispatching.
+     *
+     * @param size Maximum packet size in bytes including the fixed header, zero for no limit below the MQTT 3.1.1
+     *             maximum.
+     */
+    void set_max_packet_size(size_t size);
+
+    /**
+     * Get the maximum size of a received packet.
+     *
+     * @return Maximum packet size in bytes, zero for no limit.
+     */
+    size_t get_max_packet_size() const { return max_packet_size; }
+
+    /**
+     * Set the size from which received publish packets are streamed.
+     *
+     * Once the headers of a publish of at least this size have arrived the packet handler is offered its payload as a
+     * stream, see PacketHandler::handle_publish_stream_begin.  Streaming needs a packet handler, packets passed to the
+     * packet received callback are always buffered whole.
+     *
+     * @param size Packet size in bytes including the fixed header, zero to never stream.
+     */
+    void set_stream_threshold(size_t size) { stream_threshold = size; }
+
+    /**
+     * Get the size from which received publish packets are streamed.
+     *
+     * @return Packet size in bytes, zero if packets are never streamed.
+     */
+    size_t get_stream_threshold() const { return stream_threshold; }
+
+    /**
+     * Start sending a publish whose payload is not yet available.
+     *
+     * The fixed and variable headers are written straight away for a payload of the given length, which is then
+     * written through the returned stream.  Until the stream is closed other packets sent are held back and follow the
+     * publish, so the publish frame is never interleaved.
+     *
+     * @param header         Reference to the publish, only its flags, packet id and topic name are used.
+     * @param payload_length Length of the payload.
+     * @return               The stream, or nullptr if the connection is closed or already has a stream open.
+     */
+    std::unique_ptr<OutputStream> open_output_stream(const PublishPacket &header, size_t payload_length);
+
     /**
      * Set the network event callback.
      *
@@ -126,6 +268,12 @@ public:
         return packet_id;
     }
 
+    /** Number of packets received. */
+    uint64_t packets_received() const { return packet_count; }
+
+    /** Number of batches of packets received, each batch holds the complete packets received in one read. */
+    uint64_t batches_received() const { return batch_count; }
+
     /**
      * Pointer to the contained libevent bufferevent internal control structure.
      */
@@ -138,11 +286,87 @@ private:
      *
      * This instance method is invoked from the static input_ready callback wrapper.  It is run asynchronously
      * whenever data is received from the network connection.  The data will be buffered inside the bufferevent control
-     * structure until a complete control packet is received.  At that point the packet will be deserialized and
-     * passed to any installed packet_received_handler callback.
+     * structure until a complete control packet is received.  Every complete packet in the buffer is then deserialized
+     * in place, without first being copied out of the bufferevent, into the packet arena and the packets are passed as
+     * a batch to the installed packet handler or packet_received_handler callback.  The arena is reset once every
+     * complete packet has been dispatched.  A publish of at least the stream threshold accepted by the packet handler
+     * as a stream is not buffered whole, its payload is moved out of the input buffer and passed on as it arrives.
+     *
+     * Handlers may close the connection or destroy this PacketManager, for instance by erasing its session.  The
+     * destructor reports the latter through destroyed_flag and receiving stops in either case.
      */
     void receive_packet_data();
 
+    /**
+     * Decode and dispatch every complete packet in the input buffer.
+     *
+     * @param destroyed Reference to a flag set if this PacketManager is destroyed by a handler.
+     */
+    void dispatch_packets(const bool &destroyed);
+
+    /**
+     * Decode the complete packets at the start of the input buffer into the batch.
+     *
+     * Framing stops at the first incomplete, malformed or oversized packet.  Decoded and malformed packets are drained
+     * from the input buffer, oversized packets are drained as they arrive.
+     *
+     * @return DecodeStatus::Ok if framing stopped at an incomplete packet, otherwise the reason the packet following
+     *         the batch is malformed.
+     */
+    DecodeStatus frame_packets();
+
+    /**
+     * Dispatch the packets in the batch.
+     *
+     * @param destroyed Reference to a flag set if this PacketManager is destroyed by a handler.
+     */
+    void dispatch_batch(const bool &destroyed);
+
+    /**
+     * Offer the publish at the start of the input buffer to the packet handler as a stream.
+     *
+     * @param destroyed Reference to a flag set if this PacketManager is destroyed by a handler.
+     * @return          Framing can continue, false if the variable header has not arrived yet or receiving stopped.
+     */
+    bool begin_input_stream(const bool &destroyed);
+
+    /**
+     * Pass the streamed payload in the input buffer to the packet handler.
+     *
+     * @param destroyed Reference to a flag set if this PacketManager is destroyed by a handler.
+     */
+    void stream_input(const bool &destroyed);
+
+    /**
+     * Buffer packets are sent to.
+     *
+     * @return The output buffer, the buffer holding packets back while an output stream is open, or nullptr if nothing
+     *         can be sent.
+     */
+    struct evbuffer *output_buffer();
+
+    /**
+     * End the open output stream, invoked by OutputStream.
+     *
+     * A completed stream releases the packets held back.  An incomplete stream leaves a partial publish on the
+     * connection, nothing more is sent and the connection fails with a StreamAborted event.  The event is reported
+     * from the event loop rather than from inside the caller, which is typically handling another connection.
+     *
+     * @param complete The whole payload was written.
+     */
+    void end_output_stream(bool complete);
+
+    /**
+     * Fail the connection from inside a send.
+     *
+     * Sends run inside libevent callbacks, often of another connection, so the failure is not reported to the caller.
+     * Nothing more is sent and the event is reported from the event loop, where the event handler typically closes
+     * the connection.
+     *
+     * @param event Event to report.
+     */
+    void fail_connection(EventType event);
+
     /**
      * Libevent callback wrapper.
      *
@@ -188,23 +412,43 @@ private:
     }
 
     /**
-     * Packet deserialization method.
+     * Send a publish control packet.
      *
-     * This method will receive a packet_data_t container when the receive_packet_data method has determined
-     * that data for a complete packet has been received.  The packet will be deserialized and a reference counted
-     * pointer to the instantiated packet will be returned.
+     * The shared wire header of the message is copied into reserved output buffer space and the only bytes that
+     * differ between deliveries, the header flags and the packet id, are patched there.  Payloads of at least
+     * ReferenceThreshold bytes are not copied, the output buffer refers to them in the message and the socket write
+     * gathers them from there.  The output buffer holds a reference to the message until then.
      *
-     * @param packet_data Reference to a packet_data_t container.
-     * @return            Reference counted pointer to Packet.
+     * @param packet Reference to the packet.
      */
-    std::unique_ptr<Packet> parse_packet_data(const packet_data_t &packet_data);
+    void send_publish(const PublishPacket &packet);
+
+    /**
+     * Libevent callback wrapper.
+     *
+     * Invoked by libevent once a referenced payload has been written or discarded.  Releases the message reference
+     * taken by send_publish.
+     *
+     * @param data   Pointer to the payload.
+     * @param length Length of the payload.
+     * @param arg    Pointer to a heap allocated std::shared_ptr<const Message>.
+     */
+    static void release_message(const void *data, size_t length, void *arg);
 
     /**
      * Packet received callback.
      *
      * Callback installed to be invoked by this PacketManager when an MQTT control packet is received from the network.
      */
-    std::function<void(std::unique_ptr<Packet>)> packet_received_handler;
+    std::function<void(const Packet &)> packet_received_handler;
+
+    /**
+     * Packet handler.
+     *
+     * Handler invoked through the dispatch table when an MQTT control packet is received, used instead of the packet
+     * received callback when set.
+     */
+    PacketHandler *packet_handler = nullptr;
 
     /**
      * Network event callback.
@@ -213,6 +457,27 @@ private:
      */
     std::function<void(EventType)> event_handler;
 
+    /** Arena holding the packets decoded in the current read callback. */
+    PacketArena arena;
+
+    /** Maximum size of a received packet, zero for no limit. */
+    size_t max_packet_size = 0;
+
+    /** Bytes of an oversized packet still to be drained as they arrive. */
+    size_t discard_length = 0;
+
+    /** Packets decoded from the current read, waiting to be dispatched. */
+    std::vector<const Packet *> batch;
+
+    /** Received packet counter. */
+    uint64_t packet_count = 0;
+
+    /** Received batch counter. */
+    uint64_t batch_count = 0;
+
+    /** Flag of the running read callback, set by the destructor. */
+    bool *destroyed_flag = nullptr;
+
     /** Packet id counter. */
     uint16_t packet_id = 0;
 
@@ -222,4 +487,36 @@ private:
     /** State variable used to determine when data for a complete control packet is available. */
     size_t remaining_length = 0;
 
+    /** Size from which received publish packets are streamed, zero to never stream. */
+    size_t stream_threshold = 0;
+
+    /** Framing stopped at a publish to be offered as a stream. */
+    bool stream_pending = false;
+
+    /** The packet being framed was not streamed and is buffered whole. */
+    bool stream_declined = false;
+
+    /** Handler receiving the payload of the publish being streamed, nullptr when none is. */
+    PacketHandler *stream_handler = nullptr;
+
+    /** Payload bytes of the publish being streamed still to arrive. */
+    size_t stream_remaining = 0;
+
+    /** Buffer passing each part of a streamed payload to the handler. */
+    struct evbuffer *stream_chunk = nullptr;
+
+    /** Open output stream, nullptr when none is. */
+    OutputStream *output_stream = nullptr;
+
+    /** Packets sent while an output stream is open. */
+    struct evbuffer *deferred_output = nullptr;
+
+    /** The connection has failed, nothing more is sent. */
+    bool output_failed = false;
+
+    /** Event reported for the failed connection. */
+    EventType output_failure = EventType::NetworkError;
+
+    friend class OutputStream;
+
 };
\ No newline at end of file
@@ -0,0 +1,97 @@
+/**
+ * @file publish_stream.cc
+ */
+
+#include "publish_stream.h"
+#include "session_manager.h"
+#include "broker_session.h"
+
+#include <event2/buffer.h>
+
+#include <algorithm>
+
+PublishStream::PublishStream(SessionManager &session_manager, const PublishPacket &header, size_t payload_length,
+                             const PacketManager *source) : session_manager(session_manager), packet(header) {
+
+    std::vector<Subscriber> resolved_subscribers;
+    const std::vector<Subscriber> *subscribers = session_manager.find_subscribers(packet.topic_name(),
+                                                                                   resolved_subscribers);
+    if (!subscribers) {
+        return;
+    }
+
+    // Streamed deliveries are QoS 0, sent the way BrokerSession::forward_packet sends them
+    PublishPacket delivery(packet);
+    if (delivery.qos() != QoSType::QoS0) {
+        delivery.dup(false);
+        delivery.retain(false);
+        delivery.qos(QoSType::QoS0);
+    }
+
+    for (auto &subscriber : *subscribers) {
+
+        PacketManager *packet_manager = subscriber.group ? nullptr : subscriber.session->packet_manager.get();
+
+        std::unique_ptr<OutputStream> output;
+        if (packet_manager and packet_manager != source and std::min(packet.qos(), subscriber.qos) == QoSType::QoS0) {
+            output = packet_manager->open_output_stream(delivery, payload_length);
+        }
+
+        if (output) {
+            outputs.push_back(std::move(output));
+            streamed.push_back(packet_manager);
+        } else {
+            store = true;
+        }
+    }
+
+    if (store) {
+        payload_capacity = payload_length;
+    }
+}
+
+void PublishStream::write(struct evbuffer *chunk) {
+
+    for (auto &output : outputs) {
+        output->write(chunk);
+    }
+
+    if (store) {
+        if (payload.empty()) {
+            payload.reserve(payload_capacity);
+        }
+        size_t length = evbuffer_get_length(chunk);
+        payload.resize(payload.size() + length);
+        evbuffer_copyout(chunk, payload.data() + payload.size() - length, length);
+    }
+}
+
+const PublishPacket &PublishStream::finish() {
+
+    // Connections closed during the stream no longer identify a delivery, their address may have been reused
+    std::vector<const PacketManager *> delivered;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (outputs[i]->attached()) {
+            delivered.push_back(streamed[i]);
+        }
+        outputs[i]->close();
+    }
+    outputs.clear();
+    streamed.clear();
+
+    if (store) {
+        packet.message = std::make_shared<Message>(packet.topic_name(), std::move(payload));
+        session_manager.handle_publish(packet, delivered);
+    }
+
+    return packet;
+}
+
+void PublishStream::abort() {
+
+    for (auto &output : outputs) {
+        output->abort();
+    }
+    outputs.clear();
+    streamed.clear();
+}
@@ -0,0 +1,111 @@
+/**
+ * @file publish_stream.h
+ *
+ * Cut-through forwarding of large published messages.
+ *
+ * A publish of at least the SessionManager stream threshold is routed as soon as its topic name has arrived.  Its
+ * payload is then forwarded to subscribers as it is received rather than once the whole packet has been buffered, so
+ * the first bytes reach subscribers without waiting for the last and the broker does not hold the whole message for
+ * deliveries that can be streamed.
+ *
+ * Only QoS 0 deliveries are streamed, to sessions outside a shared subscription group whose connection is not already
+ * receiving a stream.  QoS 1 and 2 deliveries must be stored for retransmission and shared groups choose their member
+ * per message, these deliveries and those to busy connections are store and forward.  The payload is accumulated only
+ * when at least one such delivery exists and they are made through SessionManager::handle_publish once the message is
+ * complete, which is also when the publisher is acknowledged with a Puback, or a Pubrec for QoS 2.
+ *
+ * A publisher whose connection fails before the payload is complete has not published the message.  Nothing is stored
+ * or acknowledged, a QoS 1 or 2 publisher sends the message again when it reconnects.  Subscribers that received part
+ * of the message can not be sent the rest, or anything else on that connection, so their connections are failed with a
+ * PacketManager::EventType::StreamAborted event.  The same happens when the publishing session is destroyed mid-stream.
+ */
+
+#pragma once
+
+#include "packet.h"
+#include "packet_manager.h"
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct evbuffer;
+
+class SessionManager;
+
+/**
+ * PublishStream class
+ *
+ * Forwards the payload of one publish received from a client as it arrives.  Owned by the publishing BrokerSession
+ * for the duration of the packet.
+ */
+class PublishStream {
+public:
+
+    /**
+     * Constructor
+     *
+     * Resolves the subscribers of the topic name and opens an output stream to each delivery that can be streamed.
+     *
+     * @param session_manager Reference to the SessionManager.
+     * @param header          Reference to the publish, its message holds the topic name and an empty payload.
+     * @param payload_length  Length of the payload to follow.
+     * @param source          Connection of the publisher, never streamed to.
+     */
+    PublishStream(SessionManager &session_manager, const PublishPacket &header, size_t payload_length,
+                  const PacketManager *source);
+
+    PublishStream(const PublishStream &) = delete;
+
+    PublishStream &operator=(const PublishStream &) = delete;
+
+    /** Some delivery is streamed. */
+    bool streaming() const { return !outputs.empty(); }
+
+    /**
+     * Forward the next part of the payload.
+     *
+     * @param chunk Pointer to a buffer holding the part, left unchanged.
+     */
+    void write(struct evbuffer *chunk);
+
+    /**
+     * Complete the streamed deliveries once the whole payload has been written and make the store and forward ones.
+     *
+     * @return The published packet, its message holds the payload if it was accumulated.
+     */
+    const PublishPacket &finish();
+
+    /**
+     * Abandon the message, failing the connections of streamed deliveries.
+     *
+     * Also done by the destructor if the stream was not finished.
+     */
+    void abort();
+
+    ~PublishStream() { abort(); }
+
+private:
+
+    /** Reference to the SessionManager. */
+    SessionManager &session_manager;
+
+    /** The published packet. */
+    PublishPacket packet;
+
+    /** Payload bytes written so far, when accumulated for store and forward deliveries. */
+    std::vector<uint8_t> payload;
+
+    /** Length of the payload, reserved once it starts to be accumulated. */
+    size_t payload_capacity = 0;
+
+    /** Some delivery is store and forward. */
+    bool store = false;
+
+    /** Output streams of the streamed deliveries. */
+    std::vector<std::unique_ptr<OutputStream>> outputs;
+
+    /** Connection of each output stream, excluded from the store and forward deliveries. */
+    std::vector<const PacketManager *> streamed;
+};
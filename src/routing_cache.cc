@@ -0,0 +1,58 @@
+/**
+ * @file routing_cache.cc
+ */
+
+#include "routing_cache.h"
+
+const std::vector<Subscriber> *RoutingCache::find(const std::string &topic_name) {
+
+    auto entry = entries_by_topic.find(topic_name);
+
+    if (entry == entries_by_topic.end()) {
+        miss_count++;
+        return nullptr;
+    }
+
+    if (entry->second->epoch != epoch) {
+        entries.erase(entry->second);
+        entries_by_topic.erase(entry);
+        miss_count++;
+        return nullptr;
+    }
+
+    entries.splice(entries.begin(), entries, entry->second);
+    hit_count++;
+
+    return &entry->second->subscribers;
+}
+
+void RoutingCache::insert(const std::string &topic_name, const std::vector<Subscriber> &subscribers) {
+
+    if (capacity == 0) {
+        return;
+    }
+
+    auto entry = entries_by_topic.find(topic_name);
+
+    if (entry != entries_by_topic.end()) {
+        entry->second->epoch = epoch;
+        entry->second->subscribers = subscribers;
+        entries.splice(entries.begin(), entries, entry->second);
+        return;
+    }
+
+    entries.push_front(Entry{topic_name, epoch, subscribers});
+    entries_by_topic[topic_name] = entries.begin();
+
+    set_capacity(capacity);
+}
+
+void RoutingCache::set_capacity(size_t new_capacity) {
+
+    capacity = new_capacity;
+
+    while (entries.size() > capacity) {
+        entries_by_topic.erase(entries.back().topic_name);
+        entries.pop_back();
+    }
+}
@@ -0,0 +1,109 @@
+/**
+ * @file routing_cache.h
+ *
+ * Cache of resolved publish routes.
+ *
+ * Publishers tend to reuse a small set of topic names.  The RoutingCache remembers the subscribers matching recently
+ * published topic names so the SessionManager does not have to search the subscription index for every message.
+ *
+ * Cached routes are only valid for the set of subscriptions they were resolved against.  Any change to the
+ * subscriptions advances the cache epoch, entries stamped with an earlier epoch are treated as misses.
+ */
+
+#pragma once
+
+#include "subscription_index.h"
+
+#include <list>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * RoutingCache class
+ *
+ * Bounded least recently used map from topic name to matching subscribers.
+ */
+class RoutingCache {
+public:
+
+    /** Default maximum number of cached topic names. */
+    const static size_t DefaultCapacity = 4096;
+
+    /**
+     * Constructor
+     *
+     * @param capacity Maximum number of cached topic names, zero disables the cache.
+     */
+    RoutingCache(size_t capacity = DefaultCapacity) : capacity(capacity) {}
+
+    /**
+     * Look up the subscribers for a topic name.
+     *
+     * A found entry becomes the most recently used.  The hit or miss counter is updated.
+     *
+     * @param topic_name Published topic name.
+     * @return           Pointer to the cached subscribers, nullptr if not cached or stale.  The pointer is valid until
+     *                   the next call to a non-const method.
+     */
+    const std::vector<Subscriber> *find(const std::string &topic_name);
+
+    /**
+     * Cache the subscribers for a topic name at the current epoch.
+     *
+     * The least recently used entry is evicted when the cache is full.
+     *
+     * @param topic_name  Published topic name.
+     * @param subscribers Subscribers matching the topic name.
+     */
+    void insert(const std::string &topic_name, const std::vector<Subscriber> &subscribers);
+
+    /**
+     * Invalidate all cached entries.
+     *
+     * Called whenever the subscriptions change.
+     */
+    void invalidate() { epoch++; }
+
+    /**
+     * Change the maximum number of cached topic names, evicting entries as needed.
+     *
+     * @param new_capacity Maximum number of cached topic names, zero disables the cache.
+     */
+    void set_capacity(size_t new_capacity);
+
+    /** Number of cached topic names. */
+    size_t size() const { return entries.size(); }
+
+    /** Number of lookups answered from the cache. */
+    uint64_t hits() const { return hit_count; }
+
+    /** Number of lookups that had to be resolved through the subscription index. */
+    uint64_t misses() const { return miss_count; }
+
+private:
+
+    /** Cached route. */
+    struct Entry {
+        std::string topic_name;
+        uint64_t epoch;
+        std::vector<Subscriber> subscribers;
+    };
+
+    /** Maximum number of entries. */
+    size_t capacity;
+
+    /** Current subscription epoch. */
+    uint64_t epoch = 0;
+
+    /** Lookup counters. */
+    uint64_t hit_count = 0;
+    uint64_t miss_count = 0;
+
+    /** Entries ordered from most to least recently used. */
+    std::list<Entry> entries;
+
+    /** Entries keyed by topic name. */
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_by_topic;
+};
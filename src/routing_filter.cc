@@ -0,0 +1,88 @@
+/**
+ * @file routing_filter.cc
+ */
+
+#include "routing_filter.h"
+
+#include <cstring>
+
+const size_t RoutingFilter::PrefixLevels;
+
+/**
+ * FNV-1a hash of a character range.
+ */
+static uint64_t prefix_hash(const char *s, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= static_cast<uint8_t>(s[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void RoutingFilter::insert(const TopicFilter &topic_filter) {
+    count(topic_filter, 1);
+}
+
+void RoutingFilter::erase(const TopicFilter &topic_filter) {
+    count(topic_filter, -1);
+}
+
+void RoutingFilter::count(const TopicFilter &topic_filter, int delta) {
+
+    const std::vector<InternedTopic::Level> &levels = topic_filter.levels();
+
+    // Literal levels ahead of the first wildcard, at most PrefixLevels of them
+    size_t literal_levels = 0;
+    while (literal_levels < PrefixLevels and literal_levels < levels.size() and
+           levels[literal_levels].id != InternedTopic::SingleLevelWildcard and
+           levels[literal_levels].id != InternedTopic::MultiLevelWildcard) {
+        literal_levels++;
+    }
+
+    if (literal_levels == 0) {
+        wildcard_filters += delta;
+        return;
+    }
+
+    const InternedTopic::Level &last = levels[literal_levels - 1];
+    uint64_t hash = prefix_hash(topic_filter.interned()->text.data(), last.offset + last.length);
+
+    size_t &prefix_count = prefixes[hash];
+    prefix_count += delta;
+    if (prefix_count == 0) {
+        prefixes.erase(hash);
+    }
+}
+
+bool RoutingFilter::may_match(const std::string &topic_name) const {
+
+    // Wildcards in the first level never match names starting with $
+    if (wildcard_filters != 0 and (topic_name.empty() or topic_name[0] != '$')) {
+        return true;
+    }
+
+    if (prefixes.empty()) {
+        return false;
+    }
+
+    const char *s = topic_name.data();
+    const char *end = s + topic_name.size();
+    const char *level_end = s;
+
+    for (size_t level = 0; level < PrefixLevels; level++) {
+        if (level != 0) {
+            if (level_end == end) {
+                break;
+            }
+            level_end++;
+        }
+        const char *separator = static_cast<const char *>(std::memchr(level_end, '/', end - level_end));
+        level_end = separator ? separator : end;
+        if (prefixes.count(prefix_hash(s, level_end - s))) {
+            return true;
+        }
+    }
+
+    return false;
+}
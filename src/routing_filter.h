@@ -0,0 +1,71 @@
+/**
+ * @file routing_filter.h
+ *
+ * Negative routing filter.
+ *
+ * Much published traffic goes to topic names nobody subscribes to.  The RoutingFilter counts subscribed topic filters
+ * by their leading literal levels, up to two of them, so a topic name whose first and second levels cannot begin any
+ * subscribed filter is rejected after hashing those levels, without interning the name or walking the subscription
+ * index.
+ *
+ * Prefixes are counted by a 64 bit hash of their characters.  A hash collision can only let a topic name through to the
+ * subscription index, the filter never rejects a topic name that a subscription matches.
+ */
+
+#pragma once
+
+#include "topic.h"
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * RoutingFilter class
+ *
+ * Counting set of topic filter prefixes.
+ */
+class RoutingFilter {
+public:
+
+    /** Number of leading levels counted for each topic filter. */
+    const static size_t PrefixLevels = 2;
+
+    /**
+     * Count a subscribed topic filter.
+     *
+     * @param topic_filter Subscribed topic filter.
+     */
+    void insert(const TopicFilter &topic_filter);
+
+    /**
+     * Stop counting a topic filter that is no longer subscribed.
+     *
+     * @param topic_filter Topic filter previously passed to insert.
+     */
+    void erase(const TopicFilter &topic_filter);
+
+    /**
+     * Can any subscribed topic filter match a topic name.
+     *
+     * @param topic_name Published topic name.
+     * @return           False if no subscribed topic filter can match, true if one might.
+     */
+    bool may_match(const std::string &topic_name) const;
+
+private:
+
+    /**
+     * Add to the count of a prefix, or of topic filters starting with a wildcard.
+     *
+     * @param topic_filter Topic filter.
+     * @param delta        Amount added to the count.
+     */
+    void count(const TopicFilter &topic_filter, int delta);
+
+    /** Number of topic filters starting with a wildcard level, these can match any name not starting with $. */
+    size_t wildcard_filters = 0;
+
+    /** Number of topic filters starting with each prefix, keyed by prefix hash. */
+    std::unordered_map<uint64_t, size_t> prefixes;
+};
@@ -7,14 +7,26 @@
 #include "topic.h"
 
 #include <memory>
+#include <vector>
 #include <algorithm>
 
 void SessionManager::accept_connection(struct bufferevent *bev) {
 
     auto session = std::unique_ptr<BrokerSession>(new BrokerSession(bev, *this));
+    session->packet_manager->set_max_packet_size(max_packet_size);
+    session->packet_manager->set_stream_threshold(stream_threshold);
     sessions.push_back(std::move(session));
 }
 
+size_t SessionManager::max_packet_size_for(const std::string &client_id) const {
+
+    auto client_max_packet_size = client_max_packet_sizes.find(client_id);
+    if (client_max_packet_size != client_max_packet_sizes.end()) {
+        return client_max_packet_size->second;
+    }
+    return max_packet_size;
+}
+
 std::list<std::unique_ptr<BrokerSession>>::iterator SessionManager::find_session(const std::string &client_id) {
 
     return find_if(sessions.begin(), sessions.end(), [&client_id](const std::unique_ptr<BrokerSession> & s) {
@@ -23,25 +35,90 @@ std::list<std::unique_ptr<BrokerSession>>::iterator SessionManager::find_session
 }
 
 void SessionManager::erase_session(const std::string &client_id) {
-    sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [&client_id](std::unique_ptr<BrokerSession> &s) {
-        return (!s->client_id.empty() and (s->client_id == client_id));
+    sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                  [this, &client_id](std::unique_ptr<BrokerSession> &s) {
+        if (!s->client_id.empty() and (s->client_id == client_id)) {
+            drop_subscriptions(*s);
+            return true;
+        }
+        return false;
     }), sessions.end());
 }
 
 void SessionManager::erase_session(const BrokerSession *session)
 {
-    sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [session](std::unique_ptr<BrokerSession> & s) {
-        return s.get() == session;
+    sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                  [this, session](std::unique_ptr<BrokerSession> & s) {
+        if (s.get() == session) {
+            drop_subscriptions(*s);
+            return true;
+        }
+        return false;
     }), sessions.end());
 
 }
 
+void SessionManager::subscribe(BrokerSession *session, const Subscription &subscription) {
+    subscription_index.insert(session, subscription);
+    routing_cache.invalidate();
+}
+
+void SessionManager::unsubscribe(BrokerSession *session, const TopicFilter &topic_filter) {
+    subscription_index.erase(session, topic_filter);
+    routing_cache.invalidate();
+}
+
+const std::vector<Subscriber> *SessionManager::find_subscribers(const std::string &topic_name,
+                                                               std::vector<Subscriber> &resolved) {
+
+    if (!subscription_index.may_match(topic_name)) {
+        return nullptr;
+    }
+
+    const std::vector<Subscriber> *subscribers = routing_cache.find(topic_name);
+
+    if (!subscribers) {
+        // Names are validated when a publish is decoded, routing still never throws on one that is not
+        std::shared_ptr<const InternedTopic> name = TopicName::intern_name(topic_name);
+        if (!name) {
+            return nullptr;
+        }
+        subscription_index.match(TopicName(std::move(name)), resolved);
+        routing_cache.insert(topic_name, resolved);
+        subscribers = &resolved;
+    }
+
+    return subscribers;
+}
+
 void SessionManager::handle_publish(const PublishPacket & packet) {
-    for (auto &session : sessions) {
-        for (auto &subscription : session->subscriptions) {
-            if (topic_match(subscription.topic_filter, TopicName(packet.topic_name))) {
-                    session->forward_packet(packet);
-            }
+    handle_publish(packet, std::vector<const PacketManager *>());
+}
+
+void SessionManager::handle_publish(const PublishPacket &packet, const std::vector<const PacketManager *> &streamed) {
+
+    std::vector<Subscriber> resolved_subscribers;
+    const std::vector<Subscriber> *subscribers = find_subscribers(packet.topic_name(), resolved_subscribers);
+
+    if (!subscribers) {
+        dropped_count++;
+        return;
+    }
+
+    for (auto &subscriber : *subscribers) {
+        if (!streamed.empty() and !subscriber.group and
+            std::find(streamed.begin(), streamed.end(), subscriber.session->packet_manager.get()) != streamed.end()) {
+            continue;
         }
+        const Subscriber &recipient = subscriber.group ? subscriber.group->select(packet.topic_name(), share_strategy)
+                                                       : subscriber;
+        recipient.session->forward_packet(packet, std::min(packet.qos(), recipient.qos));
+    }
+}
+
+void SessionManager::drop_subscriptions(BrokerSession &session) {
+    for (auto &subscription : session.subscriptions) {
+        subscription_index.erase(&session, subscription.topic_filter);
     }
+    routing_cache.invalidate();
 }
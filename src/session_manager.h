@@ -14,14 +14,22 @@
 
 #pragma once
 
+#include "subscription_index.h"
+#include "routing_cache.h"
+#include "shared_subscription.h"
+
 #include <list>
 #include <string>
 #include <memory>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
 
 struct bufferevent;
 
 class BrokerSession;
 class PublishPacket;
+class PacketManager;
 
 /**
  * SessionManager class
@@ -36,7 +44,7 @@ public:
      * Accept a new network connection.
      *
      * Creates a new BrokerSession instance and adds it to the container of sessions.  The session instance will manage
-     * the MQTT protocol.
+     * the MQTT protocol.  The connection accepts packets up to the listener max_packet_size.
      *
      * @param bev Pointer to a bufferevent
      */
@@ -54,7 +62,7 @@ public:
      * Delete a session
      *
      * Given a pointer to a BrokerSession, finds that session in the session container and removes it from the
-     * container.  The session instance will be deleted.
+     * container.  Its subscriptions are removed from the subscription index and the session instance will be deleted.
      *
      * @param session Pointer to a BrokerSession;
      */
@@ -62,24 +70,119 @@ public:
 
     /**
      * Finds a session in the session container with the given client id.  If found the session is removed from the
-     * container.  The session instance will be deleted.
+     * container.  Its subscriptions are removed from the subscription index and the session instance will be deleted.
      *
      * @param client_id A Client id.
      */
     void erase_session(const std::string &client_id);
 
+    /**
+     * Add a session subscription to the subscription index.
+     *
+     * @param session      Pointer to the subscribing session.
+     * @param subscription Reference to the subscription.
+     */
+    void subscribe(BrokerSession *session, const Subscription &subscription);
+
+    /**
+     * Remove a session subscription from the subscription index.
+     *
+     * @param session      Pointer to the subscribing session.
+     * @param topic_filter Reference to the subscribed TopicFilter.
+     */
+    void unsubscribe(BrokerSession *session, const TopicFilter &topic_filter);
+
     /**
      * Forward a message to subsribed clients.
      *
-     * Searches through each session and their subscriptions and invokes the forward_packet method on each session
-     * instance with a matching subscribed TopicFilter.  The session will be responsible for Managing the MQTT publish
-     * protocol and correctly delivering the message to its subscribed client
+     * Messages published to a topic name the subscription index routing filter rules out are counted and discarded.
+     * Otherwise looks up the subscriptions matching the topic name in the routing cache, or the subscription index when
+     * not cached, and invokes the forward_packet method once on each session instance with a matching subscribed
+     * TopicFilter, however many of its subscriptions match.  Messages are delivered at the lower of the published QoS
+     * and the QoS granted to the subscription.  The session will be responsible for Managing the MQTT publish protocol
+     * and correctly delivering the message to its subscribed client.  Each matching shared subscription group forwards
+     * the message to a single member chosen by the share strategy.
      *
      * @param publish_packet Reference to a PublishPacket;
      */
     void handle_publish(const PublishPacket & publish_packet);
 
+    /**
+     * Forward a message to subscribed clients, except to connections the message has been streamed to.
+     *
+     * Used once a streamed publish is complete, see PublishStream.  Sessions subscribed outside a shared subscription
+     * group through one of the excluded connections are skipped.
+     *
+     * @param publish_packet Reference to a PublishPacket.
+     * @param streamed       Connections the message has already been delivered to.
+     */
+    void handle_publish(const PublishPacket & publish_packet, const std::vector<const PacketManager *> & streamed);
+
+    /**
+     * Find the subscribers matching a topic name.
+     *
+     * Looks up the routing cache and falls back to the subscription index, caching the result.
+     *
+     * @param topic_name Topic name of a published message.
+     * @param resolved   Storage for subscribers resolved from the subscription index.
+     * @return           Pointer to the subscribers, or nullptr if the routing filter rules out every subscription.
+     */
+    const std::vector<Subscriber> * find_subscribers(const std::string & topic_name, std::vector<Subscriber> & resolved);
+
     /** Container of BrokerSessions. */
     std::list<std::unique_ptr<BrokerSession>> sessions;
 
+    /** Topic filters subscribed to by all sessions. */
+    SubscriptionIndex subscription_index;
+
+    /** Recently resolved routes, invalidated whenever the subscription index changes. */
+    RoutingCache routing_cache;
+
+    /**
+     * Number of published messages discarded without a lookup because no subscription could match their topic name.
+     *
+     * @return Dropped message count.
+     */
+    uint64_t dropped() const { return dropped_count; }
+
+    /** How the member of a shared subscription group receiving a message is chosen. */
+    ShareStrategy share_strategy = ShareStrategy::RoundRobin;
+
+    /**
+     * Maximum size of a packet accepted from a client.
+     *
+     * Applies to every accepted connection until the client connects, zero for no limit below the MQTT 3.1.1 maximum.
+     */
+    size_t max_packet_size = 0;
+
+    /** Maximum packet sizes of particular clients, by client id, replacing max_packet_size once they connect. */
+    std::unordered_map<std::string, size_t> client_max_packet_sizes;
+
+    /**
+     * Maximum size of a packet accepted from a connected client.
+     *
+     * @param client_id Client id.
+     * @return          The client's own limit if one is configured, otherwise max_packet_size.
+     */
+    size_t max_packet_size_for(const std::string & client_id) const;
+
+    /**
+     * Size from which publish packets received from clients are streamed to subscribers, see PublishStream.
+     *
+     * Applies to every accepted connection, zero to buffer every packet whole.
+     */
+    size_t stream_threshold = 0;
+
+private:
+
+    /**
+     * Remove all subscriptions held by a session from the subscription index.
+     *
+     * @param session Reference to the session.
+     */
+    void drop_subscriptions(BrokerSession &session);
+
+    /** Messages discarded by the subscription index routing filter. */
+    uint64_t dropped_count = 0;
+
 };
\ No newline at end of file
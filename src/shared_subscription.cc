@@ -0,0 +1,98 @@
+/**
+ * @file shared_subscription.cc
+ */
+
+#include "shared_subscription.h"
+#include "broker_session.h"
+
+#include <algorithm>
+#include <functional>
+
+const std::string SharedFilter::Prefix = "$share/";
+
+bool SharedFilter::is_shared(const TopicFilter &share_filter) {
+    return share_filter.interned()->text.compare(0, Prefix.size(), Prefix) == 0;
+}
+
+bool SharedFilter::is_valid(const TopicFilter &share_filter) {
+
+    const std::vector<InternedTopic::Level> &levels = share_filter.levels();
+
+    if (!is_shared(share_filter) or levels.size() < 3) {
+        return false;
+    }
+
+    const InternedTopic::Level &group = levels[1];
+    if (group.length == 0 or group.id == InternedTopic::SingleLevelWildcard or
+        group.id == InternedTopic::MultiLevelWildcard) {
+        return false;
+    }
+
+    // The group must be followed by a non empty filter
+    return !(levels.size() == 3 and levels[2].length == 0);
+}
+
+/**
+ * Validate a shared subscription filter and extract the topic filter subscribed to by the group.
+ */
+static std::string group_topic_filter(const TopicFilter &share_filter) {
+    if (!SharedFilter::is_valid(share_filter)) {
+        throw std::exception();
+    }
+    return share_filter.interned()->text.substr(share_filter.levels()[2].offset);
+}
+
+SharedFilter::SharedFilter(const TopicFilter &share_filter) : topic_filter(group_topic_filter(share_filter)) {
+    const InternedTopic::Level &level = share_filter.levels()[1];
+    group = share_filter.interned()->text.substr(level.offset, level.length);
+}
+
+bool SharedGroup::insert(BrokerSession *session, QoSType qos) {
+
+    auto member = std::find_if(members.begin(), members.end(),
+                               [session](const Subscriber &s) { return s.session == session; });
+    if (member != members.end()) {
+        member->qos = qos;
+        return false;
+    }
+
+    members.push_back(Subscriber{session, qos, nullptr});
+    return true;
+}
+
+bool SharedGroup::erase(BrokerSession *session) {
+
+    auto member = std::find_if(members.begin(), members.end(),
+                               [session](const Subscriber &s) { return s.session == session; });
+    if (member == members.end()) {
+        return false;
+    }
+
+    members.erase(member);
+    return true;
+}
+
+const Subscriber &SharedGroup::select(const std::string &topic_name, ShareStrategy strategy) {
+
+    size_t count = members.size();
+
+    if (strategy == ShareStrategy::StickyTopic) {
+        return members[std::hash<std::string>()(topic_name) % count];
+    }
+
+    size_t start = next.fetch_add(1, std::memory_order_relaxed);
+    size_t selected = start % count;
+
+    if (strategy == ShareStrategy::LeastInflight) {
+        for (size_t i = 1; i < count; i++) {
+            size_t candidate = (start + i) % count;
+            if (members[candidate].session->qos1_inflight.load(std::memory_order_relaxed) <
+                members[selected].session->qos1_inflight.load(std::memory_order_relaxed)) {
+                selected = candidate;
+            }
+        }
+        next.store(selected + 1, std::memory_order_relaxed);
+    }
+
+    return members[selected];
+}
@@ -0,0 +1,136 @@
+/**
+ * @file shared_subscription.h
+ *
+ * Shared subscriptions.
+ *
+ * A subscription to a topic filter of the form $share/<group>/<filter> makes the session a member of a consumer group.
+ * Every member of the group subscribes to the same <filter>.  A message matching the filter is delivered to exactly
+ * one member of the group rather than to each of them, so adding members spreads the load across them.  Sessions
+ * with ordinary subscriptions to the same filter still receive every message.
+ *
+ * The member receiving a message is chosen by a ShareStrategy configured in the SessionManager.
+ */
+
+#pragma once
+
+#include "subscription_index.h"
+#include "topic.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+/**
+ * Strategies for choosing the member of a shared group that receives a message.
+ */
+enum class ShareStrategy {
+
+    /** Members take turns. */
+    RoundRobin,
+
+    /** The member with the fewest QoS 1 messages waiting for Puback, ties are broken round robin. */
+    LeastInflight,
+
+    /** Messages with the same topic name go to the same member as long as the group membership does not change. */
+    StickyTopic
+};
+
+/**
+ * SharedFilter class
+ *
+ * A shared subscription topic filter split into its group name and the topic filter subscribed to by the group.
+ */
+class SharedFilter {
+public:
+
+    /** Leading characters identifying a shared subscription. */
+    static const std::string Prefix;
+
+    /**
+     * Does the topic filter start with the shared subscription prefix.
+     *
+     * @param share_filter Subscribed topic filter.
+     * @return             Is a shared subscription.
+     */
+    static bool is_shared(const TopicFilter & share_filter);
+
+    /**
+     * Validate a shared subscription topic filter.
+     *
+     * The group name must be a non empty level without wildcards and must be followed by a non empty topic filter.
+     *
+     * @param share_filter Subscribed topic filter starting with the shared subscription prefix.
+     * @return             Filter is valid.
+     */
+    static bool is_valid(const TopicFilter & share_filter);
+
+    /**
+     * Constructor
+     *
+     * An exception will be thrown if the filter is not a valid shared subscription.
+     *
+     * @param share_filter Subscribed topic filter.
+     */
+    SharedFilter(const TopicFilter & share_filter);
+
+    /** Name of the shared group. */
+    std::string group;
+
+    /** Topic filter subscribed to by the group. */
+    TopicFilter topic_filter;
+};
+
+/**
+ * SharedGroup class
+ *
+ * Members of a shared subscription group.  Groups are identified by the complete $share/<group>/<filter> topic filter.
+ */
+class SharedGroup {
+public:
+
+    /**
+     * Constructor
+     *
+     * @param share_filter Complete shared subscription topic filter, keeps its id in use.
+     */
+    SharedGroup(const std::shared_ptr<const InternedTopic> & share_filter) : share_filter(share_filter) {}
+
+    /**
+     * Add a member or update its granted QoS.
+     *
+     * @param session Pointer to the subscribing session.
+     * @param qos     Granted QoS.
+     * @return        A member was added.
+     */
+    bool insert(BrokerSession *session, QoSType qos);
+
+    /**
+     * Remove a member.
+     *
+     * @param session Pointer to the subscribing session.
+     * @return        A member was removed.
+     */
+    bool erase(BrokerSession *session);
+
+    /**
+     * Choose the member that receives a message.
+     *
+     * @param topic_name Published topic name.
+     * @param strategy   Strategy used to choose the member.
+     * @return           Reference to the chosen member, the group must not be empty.  Safe to call from several threads
+     *                   while the members are not modified.
+     */
+    const Subscriber & select(const std::string & topic_name, ShareStrategy strategy);
+
+    /** Complete shared subscription topic filter. */
+    std::shared_ptr<const InternedTopic> share_filter;
+
+    /** Group members. */
+    std::vector<Subscriber> members;
+
+private:
+
+    /** Position of the next member for round robin selection, concurrent readers may select members. */
+    std::atomic<size_t> next{0};
+};
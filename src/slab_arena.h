@@ -0,0 +1,111 @@
+/**
+ * @file slab_arena.h
+ *
+ * Fixed size object arena.
+ *
+ * Objects are stored in slabs holding SlabSize objects each and are referred to by a 32 bit index instead of a
+ * pointer.  Allocating an object takes a free slot, a new slab is only added when every slot is in use.  Slabs are
+ * never moved, references to objects stay valid while other objects are allocated or released.
+ *
+ * Objects are allocated together so walking related objects touches fewer cache lines and far fewer heap blocks than
+ * individually allocated objects.  A sparse arena can be compacted by copying the live objects into a new arena and
+ * swapping it in.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+/**
+ * SlabArena class
+ *
+ * Arena of default constructible, move assignable objects.  Released objects are reset to a default constructed
+ * value.
+ */
+template<typename T>
+class SlabArena {
+public:
+
+    /** Reference to an object in the arena. */
+    typedef uint32_t Ref;
+
+    /** Reference to no object. */
+    static const Ref Null = UINT32_MAX;
+
+    /** Number of objects in each slab. */
+    static const size_t SlabSize = 256;
+
+    /**
+     * Allocate an object.
+     *
+     * @return Reference to a default constructed object.
+     */
+    Ref allocate() {
+        if (free_refs.empty()) {
+            Ref first = static_cast<Ref>(slabs.size() * SlabSize);
+            slabs.emplace_back(new T[SlabSize]);
+            for (size_t i = SlabSize; i > 0; i--) {
+                free_refs.push_back(first + static_cast<Ref>(i - 1));
+            }
+        }
+        Ref ref = free_refs.back();
+        free_refs.pop_back();
+        live++;
+        return ref;
+    }
+
+    /**
+     * Release an object, the reference must not be used again.
+     *
+     * @param ref Reference to the object.
+     */
+    void release(Ref ref) {
+        (*this)[ref] = T();
+        free_refs.push_back(ref);
+        live--;
+    }
+
+    T &operator[](Ref ref) { return slabs[ref / SlabSize][ref % SlabSize]; }
+
+    const T &operator[](Ref ref) const { return slabs[ref / SlabSize][ref % SlabSize]; }
+
+    /** Number of allocated objects. */
+    size_t size() const { return live; }
+
+    /** Number of object slots in all slabs. */
+    size_t capacity() const { return slabs.size() * SlabSize; }
+
+    /**
+     * The arena spans more than one slab and fewer than half of its slots are in use.
+     *
+     * @return Arena would benefit from compaction.
+     */
+    bool sparse() const { return slabs.size() > 1 and live * 2 < capacity(); }
+
+    /** Exchange contents with another arena. */
+    void swap(SlabArena &other) {
+        slabs.swap(other.slabs);
+        free_refs.swap(other.free_refs);
+        std::swap(live, other.live);
+    }
+
+private:
+
+    /** Object storage. */
+    std::vector<std::unique_ptr<T[]>> slabs;
+
+    /** Unused slots, the next allocation takes the last one. */
+    std::vector<Ref> free_refs;
+
+    /** Number of allocated objects. */
+    size_t live = 0;
+};
+
+template<typename T>
+const typename SlabArena<T>::Ref SlabArena<T>::Null;
+
+template<typename T>
+const size_t SlabArena<T>::SlabSize;
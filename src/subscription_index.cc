@@ -0,0 +1,507 @@
+/**
+ * @file subscription_index.cc
+ */
+
+#include "subscription_index.h"
+#include "shared_subscription.h"
+
+#include <algorithm>
+#include <functional>
+
+SubscriptionIndex::SubscriptionIndex() {}
+
+SubscriptionIndex::~SubscriptionIndex() {}
+
+static inline bool is_wildcard(uint32_t id) {
+    return id == InternedTopic::SingleLevelWildcard or id == InternedTopic::MultiLevelWildcard;
+}
+
+SubscriptionIndex::NodeRef SubscriptionIndex::Node::find_child(uint32_t id) const {
+
+    if (hashed_children) {
+        auto child = hashed_children->find(id);
+        return (child == hashed_children->end()) ? SlabArena<Node>::Null : child->second;
+    }
+
+    for (size_t i = 0; i < inline_child_count; i++) {
+        if (child_ids[i] == id) {
+            return child_refs[i];
+        }
+    }
+
+    return SlabArena<Node>::Null;
+}
+
+void SubscriptionIndex::Node::insert_child(uint32_t id, NodeRef child) {
+
+    if (hashed_children) {
+        (*hashed_children)[id] = child;
+        return;
+    }
+
+    for (size_t i = 0; i < inline_child_count; i++) {
+        if (child_ids[i] == id) {
+            child_refs[i] = child;
+            return;
+        }
+    }
+
+    if (inline_child_count < InlineChildren) {
+        child_ids[inline_child_count] = id;
+        child_refs[inline_child_count] = child;
+        inline_child_count++;
+        return;
+    }
+
+    hashed_children.reset(new std::unordered_map<uint32_t, NodeRef>);
+    for (size_t i = 0; i < inline_child_count; i++) {
+        (*hashed_children)[child_ids[i]] = child_refs[i];
+    }
+    (*hashed_children)[id] = child;
+    inline_child_count = 0;
+}
+
+void SubscriptionIndex::Node::erase_child(uint32_t id) {
+
+    if (hashed_children) {
+        hashed_children->erase(id);
+        return;
+    }
+
+    for (size_t i = 0; i < inline_child_count; i++) {
+        if (child_ids[i] == id) {
+            inline_child_count--;
+            child_ids[i] = child_ids[inline_child_count];
+            child_refs[i] = child_refs[inline_child_count];
+            return;
+        }
+    }
+}
+
+size_t SubscriptionIndex::Node::child_count() const {
+    return hashed_children ? hashed_children->size() : inline_child_count;
+}
+
+template<typename NodeType, typename F>
+void SubscriptionIndex::Node::for_each_child(NodeType &node, F f) {
+
+    if (node.hashed_children) {
+        for (auto &child : *node.hashed_children) {
+            f(child.second);
+        }
+    } else {
+        for (size_t i = 0; i < node.inline_child_count; i++) {
+            f(node.child_refs[i]);
+        }
+    }
+
+    if (node.single_level_wildcard != SlabArena<Node>::Null) {
+        f(node.single_level_wildcard);
+    }
+
+    if (node.multi_level_wildcard != SlabArena<Node>::Null) {
+        f(node.multi_level_wildcard);
+    }
+}
+
+bool SubscriptionIndex::Node::empty() const {
+    return subscribers.empty() and child_count() == 0 and single_level_wildcard == SlabArena<Node>::Null and
+           multi_level_wildcard == SlabArena<Node>::Null;
+}
+
+/**
+ * Sessions are compared by pointer, shared groups by group pointer.
+ */
+static bool same_subscriber(const Subscriber &a, const Subscriber &b) {
+    return a.session == b.session and a.group == b.group;
+}
+
+bool SubscriptionIndex::insert(std::vector<Subscriber> &subscribers, const Subscriber &subscriber) {
+
+    auto previous_subscriber = std::find_if(subscribers.begin(), subscribers.end(),
+                                            [&subscriber](const Subscriber &s) {
+                                                return same_subscriber(s, subscriber);
+                                            });
+    if (previous_subscriber != subscribers.end()) {
+        previous_subscriber->qos = subscriber.qos;
+        return false;
+    }
+
+    subscribers.push_back(subscriber);
+    return true;
+}
+
+bool SubscriptionIndex::erase(std::vector<Subscriber> &subscribers, const Subscriber &subscriber) {
+
+    auto previous_subscriber = std::find_if(subscribers.begin(), subscribers.end(),
+                                            [&subscriber](const Subscriber &s) {
+                                                return same_subscriber(s, subscriber);
+                                            });
+    if (previous_subscriber == subscribers.end()) {
+        return false;
+    }
+
+    subscribers.erase(previous_subscriber);
+    return true;
+}
+
+void SubscriptionIndex::insert(BrokerSession *session, const Subscription &subscription) {
+
+    if (!SharedFilter::is_shared(subscription.topic_filter)) {
+        if (insert(subscription.topic_filter, Subscriber{session, subscription.qos, nullptr})) {
+            subscription_count++;
+        }
+        return;
+    }
+
+    SharedFilter shared_filter(subscription.topic_filter);
+
+    std::unique_ptr<SharedGroup> &group = shared_groups[subscription.topic_filter.id()];
+    if (!group) {
+        group.reset(new SharedGroup(subscription.topic_filter.interned()));
+        insert(shared_filter.topic_filter, Subscriber{nullptr, QoSType::QoS0, group.get()});
+    }
+
+    if (group->insert(session, subscription.qos)) {
+        subscription_count++;
+    }
+}
+
+bool SubscriptionIndex::insert(const TopicFilter &topic_filter, const Subscriber &subscriber) {
+
+    std::vector<Subscriber> &subscribers = subscriber_slot(topic_filter);
+
+    if (!insert(subscribers, subscriber)) {
+        return false;
+    }
+
+    routing_filter.insert(topic_filter);
+    return true;
+}
+
+std::vector<Subscriber> &SubscriptionIndex::subscriber_slot(const TopicFilter &topic_filter) {
+
+    Partition &partition = partition_for(topic_filter.interned()->text);
+
+    if (!topic_filter.has_wildcards()) {
+        ExactSubscribers &exact = partition.exact_subscribers[topic_filter.id()];
+        exact.topic_filter = topic_filter.interned();
+        return exact.subscribers;
+    }
+
+    const std::vector<InternedTopic::Level> &levels = topic_filter.levels();
+
+    // Arena slabs never move, node references stay valid as nodes are allocated
+    Node *node = &partition.root;
+    size_t level = 0;
+
+    while (level < levels.size()) {
+
+        uint32_t id = levels[level].id;
+
+        if (is_wildcard(id)) {
+            NodeRef &child = (id == InternedTopic::SingleLevelWildcard) ? node->single_level_wildcard
+                                                                         : node->multi_level_wildcard;
+            if (child == SlabArena<Node>::Null) {
+                child = nodes.allocate();
+            }
+            node = &nodes[child];
+            level++;
+            continue;
+        }
+
+        NodeRef child = node->find_child(id);
+
+        if (child == SlabArena<Node>::Null) {
+            // New branch, holds every literal level up to the next wildcard
+            NodeRef branch = nodes.allocate();
+            Node &branch_node = nodes[branch];
+            while (level < levels.size() and !is_wildcard(levels[level].id)) {
+                branch_node.edge.push_back(levels[level].id);
+                level++;
+            }
+            node->insert_child(id, branch);
+            node = &branch_node;
+            continue;
+        }
+
+        Node &child_node = nodes[child];
+
+        size_t common = 1;
+        while (common < child_node.edge.size() and level + common < levels.size() and
+               child_node.edge[common] == levels[level + common].id) {
+            common++;
+        }
+
+        if (common < child_node.edge.size()) {
+            // The filter leaves the edge part way along, split it
+            NodeRef split = nodes.allocate();
+            Node &split_node = nodes[split];
+            split_node.edge.assign(child_node.edge.begin(), child_node.edge.begin() + common);
+            child_node.edge.erase(child_node.edge.begin(), child_node.edge.begin() + common);
+            split_node.insert_child(child_node.edge[0], child);
+            node->insert_child(id, split);
+            node = &split_node;
+        } else {
+            node = &child_node;
+        }
+
+        level += common;
+    }
+
+    node->topic_filter = topic_filter.interned();
+    return node->subscribers;
+}
+
+bool SubscriptionIndex::erase(BrokerSession *session, const TopicFilter &topic_filter) {
+
+    if (!SharedFilter::is_shared(topic_filter)) {
+        if (erase(topic_filter, Subscriber{session, QoSType::QoS0, nullptr})) {
+            subscription_count--;
+            return true;
+        }
+        return false;
+    }
+
+    auto group = shared_groups.find(topic_filter.id());
+    if (group == shared_groups.end() or !group->second->erase(session)) {
+        return false;
+    }
+
+    if (group->second->members.empty()) {
+        SharedFilter shared_filter(topic_filter);
+        erase(shared_filter.topic_filter, Subscriber{nullptr, QoSType::QoS0, group->second.get()});
+        shared_groups.erase(group);
+    }
+
+    subscription_count--;
+    return true;
+}
+
+bool SubscriptionIndex::erase(const TopicFilter &topic_filter, const Subscriber &subscriber) {
+
+    Partition &partition = partition_for(topic_filter.interned()->text);
+
+    if (!topic_filter.has_wildcards()) {
+        auto exact = partition.exact_subscribers.find(topic_filter.id());
+        if (exact == partition.exact_subscribers.end() or !erase(exact->second.subscribers, subscriber)) {
+            return false;
+        }
+        if (exact->second.subscribers.empty()) {
+            partition.exact_subscribers.erase(exact);
+        }
+        routing_filter.erase(topic_filter);
+        return true;
+    }
+
+    if (!erase(partition.root, topic_filter.levels(), 0, subscriber)) {
+        return false;
+    }
+
+    routing_filter.erase(topic_filter);
+
+    if (nodes.sparse()) {
+        compact();
+    }
+
+    return true;
+}
+
+bool SubscriptionIndex::erase(Node &node, const std::vector<InternedTopic::Level> &levels, size_t level,
+                              const Subscriber &subscriber) {
+
+    if (level == levels.size()) {
+        if (!erase(node.subscribers, subscriber)) {
+            return false;
+        }
+        if (node.subscribers.empty()) {
+            node.topic_filter.reset();
+        }
+        return true;
+    }
+
+    uint32_t id = levels[level].id;
+
+    if (is_wildcard(id)) {
+        NodeRef &child = (id == InternedTopic::SingleLevelWildcard) ? node.single_level_wildcard
+                                                                     : node.multi_level_wildcard;
+        if (child == SlabArena<Node>::Null or !erase(nodes[child], levels, level + 1, subscriber)) {
+            return false;
+        }
+        if (nodes[child].empty()) {
+            nodes.release(child);
+            child = SlabArena<Node>::Null;
+        }
+        return true;
+    }
+
+    NodeRef child = node.find_child(id);
+    if (child == SlabArena<Node>::Null) {
+        return false;
+    }
+
+    const std::vector<uint32_t> &edge = nodes[child].edge;
+    if (level + edge.size() > levels.size()) {
+        return false;
+    }
+    for (size_t i = 1; i < edge.size(); i++) {
+        if (edge[i] != levels[level + i].id) {
+            return false;
+        }
+    }
+
+    if (!erase(nodes[child], levels, level + edge.size(), subscriber)) {
+        return false;
+    }
+
+    if (nodes[child].empty()) {
+        node.erase_child(id);
+        nodes.release(child);
+    } else {
+        merge(child);
+    }
+
+    return true;
+}
+
+void SubscriptionIndex::merge(NodeRef ref) {
+
+    Node &node = nodes[ref];
+
+    if (!node.subscribers.empty() or node.child_count() != 1 or node.single_level_wildcard != SlabArena<Node>::Null or
+        node.multi_level_wildcard != SlabArena<Node>::Null) {
+        return;
+    }
+
+    NodeRef child = SlabArena<Node>::Null;
+    Node::for_each_child(node, [&child](NodeRef c) { child = c; });
+
+    // The merged node keeps the first level of its edge, so the parent key is unchanged
+    Node &child_node = nodes[child];
+    child_node.edge.insert(child_node.edge.begin(), node.edge.begin(), node.edge.end());
+    node = std::move(child_node);
+    nodes.release(child);
+}
+
+void SubscriptionIndex::compact() {
+
+    SlabArena<Node> arena;
+    relocate(topics.root, arena);
+    relocate(system_topics.root, arena);
+    nodes.swap(arena);
+}
+
+void SubscriptionIndex::relocate(Node &node, SlabArena<Node> &arena) {
+
+    Node::for_each_child(node, [this, &arena](NodeRef &child) {
+        NodeRef relocated = arena.allocate();
+        arena[relocated] = std::move(nodes[child]);
+        relocate(arena[relocated], arena);
+        child = relocated;
+    });
+}
+
+size_t SubscriptionIndex::bytes_used() const {
+
+    size_t bytes = sizeof(*this) + nodes.capacity() * sizeof(Node);
+
+    for (const Partition *partition : {&topics, &system_topics}) {
+        bytes += bytes_used(partition->root) + partition->exact_subscribers.bucket_count() * sizeof(void *);
+        for (auto &exact : partition->exact_subscribers) {
+            bytes += sizeof(exact) + sizeof(void *) + exact.second.subscribers.capacity() * sizeof(Subscriber);
+        }
+    }
+
+    return bytes;
+}
+
+size_t SubscriptionIndex::bytes_used(const Node &node) const {
+
+    size_t bytes = node.edge.capacity() * sizeof(uint32_t) + node.subscribers.capacity() * sizeof(Subscriber);
+
+    if (node.hashed_children) {
+        bytes += sizeof(*node.hashed_children) + node.hashed_children->bucket_count() * sizeof(void *) +
+                 node.hashed_children->size() * (sizeof(std::pair<uint32_t, NodeRef>) + sizeof(void *));
+    }
+
+    Node::for_each_child(node, [this, &bytes](NodeRef child) {
+        bytes += bytes_used(nodes[child]);
+    });
+
+    return bytes;
+}
+
+void SubscriptionIndex::match(const TopicName &topic_name, std::vector<Subscriber> &subscribers) const {
+
+    const std::string &name = topic_name.interned()->text;
+
+    // empty strings don't match
+    if (name.empty()) {
+        return;
+    }
+
+    size_t first = subscribers.size();
+
+    const Partition &partition = partition_for(name);
+
+    auto exact = partition.exact_subscribers.find(topic_name.id());
+    if (exact != partition.exact_subscribers.end()) {
+        subscribers.insert(subscribers.end(), exact->second.subscribers.begin(), exact->second.subscribers.end());
+    }
+
+    if (!partition.root.empty()) {
+        match(partition.root, topic_name.levels(), 0, subscribers);
+    }
+
+    if (subscribers.size() - first > 1) {
+        collapse(subscribers, first);
+    }
+}
+
+void SubscriptionIndex::collapse(std::vector<Subscriber> &subscribers, size_t first) {
+
+    std::sort(subscribers.begin() + first, subscribers.end(), [](const Subscriber &a, const Subscriber &b) {
+        return (a.group != b.group) ? std::less<SharedGroup *>()(a.group, b.group)
+                                    : std::less<BrokerSession *>()(a.session, b.session);
+    });
+
+    auto last = subscribers.begin() + first;
+    for (auto subscriber = last + 1; subscriber != subscribers.end(); ++subscriber) {
+        if (same_subscriber(*last, *subscriber)) {
+            last->qos = std::max(last->qos, subscriber->qos);
+        } else {
+            *++last = *subscriber;
+        }
+    }
+
+    subscribers.erase(last + 1, subscribers.end());
+}
+
+void SubscriptionIndex::match(const Node &node, const std::vector<InternedTopic::Level> &levels, size_t level,
+                              std::vector<Subscriber> &subscribers) const {
+
+    if (node.multi_level_wildcard != SlabArena<Node>::Null) {
+        const std::vector<Subscriber> &s = nodes[node.multi_level_wildcard].subscribers;
+        subscribers.insert(subscribers.end(), s.begin(), s.end());
+    }
+
+    if (level == levels.size()) {
+        subscribers.insert(subscribers.end(), node.subscribers.begin(), node.subscribers.end());
+        return;
+    }
+
+    NodeRef child = node.find_child(levels[level].id);
+    if (child != SlabArena<Node>::Null) {
+        const Node &child_node = nodes[child];
+        size_t end = level + child_node.edge.size();
+        if (end <= levels.size() and
+            std::equal(child_node.edge.begin() + 1, child_node.edge.end(), levels.begin() + level + 1,
+                       [](uint32_t id, const InternedTopic::Level &l) { return id == l.id; })) {
+            match(child_node, levels, end, subscribers);
+        }
+    }
+
+    if (node.single_level_wildcard != SlabArena<Node>::Null) {
+        match(nodes[node.single_level_wildcard], levels, level + 1, subscribers);
+    }
+}
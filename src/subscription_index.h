@@ -0,0 +1,320 @@
+/**
+ * @file subscription_index.h
+ *
+ * Index of the topic filters subscribed to by broker sessions.
+ *
+ * Topic filters are stored in a tree of topic levels.  Each node has a child for every literal level below it along
+ * with separate slots for the single level '+' and multi level '#' wildcards.  Matching a topic name walks only the
+ * branches that can match that name rather than comparing it against every subscription held by every session.
+ * Children are keyed by interned level id, so the walk compares integers instead of strings.
+ *
+ * The tree is path compressed, a run of literal levels without branches is held by a single node.  Nodes keep a few
+ * children inline and move them to a hash table once they have more.  All nodes are allocated from a slab arena which
+ * is compacted when removals leave it mostly empty.
+ *
+ * A RoutingFilter counting the leading levels of every subscribed topic filter rejects most topic names without a
+ * subscriber before they reach the tree.
+ *
+ * Most topic filters contain no wildcards and can only match a topic name with the same characters.  These are kept
+ * out of the tree in a hash table keyed by the interned topic id so matching them costs a single lookup.
+ *
+ * Topic filters starting with '$' are kept in a separate partition and only topic names starting with '$' are matched
+ * against it.  Wildcards in the first level cannot match these names, so the partition holding every other topic
+ * filter needs no special case for them and system topics such as $SYS/# do not add to the main tree.
+ *
+ * Shared subscriptions are stored under the topic filter subscribed to by their group.  The group takes a single
+ * subscriber slot in the tree or hash table, a match returns the group and the member receiving the message is chosen
+ * when the message is forwarded.
+ */
+
+#pragma once
+
+#include "packet.h"
+#include "topic.h"
+#include "slab_arena.h"
+#include "routing_filter.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+class BrokerSession;
+class SharedGroup;
+
+/**
+ * Subscriber
+ *
+ * A session subscribed to a topic filter along with the QoS granted for that subscription, or a shared subscription
+ * group.
+ */
+struct Subscriber {
+
+    /** The subscribing session, nullptr for a shared group. */
+    BrokerSession *session;
+
+    /** QoS granted for the subscription. */
+    QoSType qos;
+
+    /** The shared subscription group, nullptr for a session. */
+    SharedGroup *group;
+};
+
+/**
+ * SubscriptionIndex class
+ *
+ * Hash table of wildcard free subscriptions and topic level tree of wildcard subscriptions.  The index does not own
+ * the sessions it refers to, sessions must be removed from the index before they are destroyed.
+ */
+class SubscriptionIndex {
+public:
+
+    /** Constructor */
+    SubscriptionIndex();
+
+    /** Destructor */
+    ~SubscriptionIndex();
+
+    /**
+     * Add a subscription to the index.
+     *
+     * A previous subscription by the same session to an identical topic filter will be replaced, overriding the
+     * granted QoS.  A $share/<group>/<filter> subscription adds the session to the shared group, the group is created
+     * on its first subscription.  An exception will be thrown if a shared subscription filter is not valid.
+     *
+     * @param session      Pointer to the subscribing session.
+     * @param subscription Reference to the subscription.
+     */
+    void insert(BrokerSession *session, const Subscription &subscription);
+
+    /**
+     * Remove a subscription from the index.
+     *
+     * Tree nodes left without subscriptions or children are released.  A shared group is released along with its last
+     * member.
+     *
+     * @param session      Pointer to the subscribing session.
+     * @param topic_filter Topic filter to remove, compared character by character.
+     * @return             A subscription was removed.
+     */
+    bool erase(BrokerSession *session, const TopicFilter &topic_filter);
+
+    /**
+     * Find all subscriptions matching a topic name.
+     *
+     * The MQTT 3.1.1 standard matching rules are applied.  Subscribers are appended to the container, a session
+     * holding more than one matching subscription appears once with the maximum QoS granted by those subscriptions.
+     * Each matching shared group appears once, its pointer stays valid until the index is next modified.
+     *
+     * @param topic_name  Reference to the published TopicName.
+     * @param subscribers Container to append matching subscribers to.
+     */
+    void match(const TopicName &topic_name, std::vector<Subscriber> &subscribers) const;
+
+    /**
+     * Quick check whether any subscription can match a topic name.
+     *
+     * Costs a hash of the first topic levels, a topic name rejected here needs no call to match.
+     *
+     * @param topic_name Published topic name.
+     * @return           False if no subscription matches the name, true if one might.
+     */
+    bool may_match(const std::string &topic_name) const { return routing_filter.may_match(topic_name); }
+
+    /**
+     * Number of subscriptions in the index.
+     *
+     * @return Subscription count.
+     */
+    size_t size() const { return subscription_count; }
+
+    /**
+     * Number of topic level tree nodes, including the roots of both partitions.
+     *
+     * @return Node count.
+     */
+    size_t node_count() const { return nodes.size() + 2; }
+
+    /**
+     * Approximate memory used by the index.
+     *
+     * Counts the node arena, the storage held by each node and the hash table of wildcard free subscriptions.
+     *
+     * @return Bytes used.
+     */
+    size_t bytes_used() const;
+
+private:
+
+    /** Reference to a node in the arena. */
+    typedef uint32_t NodeRef;
+
+    /**
+     * Tree node for a run of literal topic levels or a single wildcard level.
+     */
+    struct Node {
+
+        /** Children held inline before moving to the hash table. */
+        static const size_t InlineChildren = 4;
+
+        /**
+         * Level ids of the literal levels between the parent and this node, the first keys this node in its parent.
+         * Empty for wildcard children.
+         */
+        std::vector<uint32_t> edge;
+
+        /** Inline children for literal topic levels. */
+        uint32_t child_ids[InlineChildren] = {};
+        NodeRef child_refs[InlineChildren] = {};
+        uint8_t inline_child_count = 0;
+
+        /** Children for literal topic levels keyed by level id, replaces the inline children when present. */
+        std::unique_ptr<std::unordered_map<uint32_t, NodeRef>> hashed_children;
+
+        /** Child for a '+' topic level. */
+        NodeRef single_level_wildcard = SlabArena<Node>::Null;
+
+        /** Child for a '#' topic level. */
+        NodeRef multi_level_wildcard = SlabArena<Node>::Null;
+
+        /** Subscribers with a topic filter ending at this node. */
+        std::vector<Subscriber> subscribers;
+
+        /** Topic filter ending at this node, keeps the level ids along the path to this node in use. */
+        std::shared_ptr<const InternedTopic> topic_filter;
+
+        /** Find the literal child keyed by a level id, SlabArena<Node>::Null if not present. */
+        NodeRef find_child(uint32_t id) const;
+
+        /** Add or replace the literal child keyed by a level id. */
+        void insert_child(uint32_t id, NodeRef child);
+
+        /** Remove the literal child keyed by a level id. */
+        void erase_child(uint32_t id);
+
+        /** Number of literal children. */
+        size_t child_count() const;
+
+        /** Call a function with a reference to each child reference of a node, literal and wildcard. */
+        template<typename NodeType, typename F>
+        static void for_each_child(NodeType &node, F f);
+
+        /** Node has no subscribers and no children. */
+        bool empty() const;
+    };
+
+    /**
+     * Subscribers to a topic filter without wildcards.
+     */
+    struct ExactSubscribers {
+
+        /** The topic filter, keeps its id in use. */
+        std::shared_ptr<const InternedTopic> topic_filter;
+
+        /** Subscribers to the topic filter. */
+        std::vector<Subscriber> subscribers;
+    };
+
+    /**
+     * Remove a session or shared group from a list of subscribers.
+     *
+     * @return A subscriber was removed.
+     */
+    static bool erase(std::vector<Subscriber> &subscribers, const Subscriber &subscriber);
+
+    /**
+     * Add a session or shared group to a list of subscribers or update its granted QoS.
+     *
+     * @return A subscriber was added.
+     */
+    static bool insert(std::vector<Subscriber> &subscribers, const Subscriber &subscriber);
+
+    /**
+     * Add a subscriber to the hash table or tree slot for a topic filter.
+     *
+     * @return A subscriber was added.
+     */
+    bool insert(const TopicFilter &topic_filter, const Subscriber &subscriber);
+
+    /**
+     * Find or create the hash table entry or tree node holding the subscribers to a topic filter.
+     *
+     * @return Reference to the subscribers.
+     */
+    std::vector<Subscriber> &subscriber_slot(const TopicFilter &topic_filter);
+
+    /**
+     * Remove a subscriber from the hash table or tree slot for a topic filter.
+     *
+     * @return A subscriber was removed.
+     */
+    bool erase(const TopicFilter &topic_filter, const Subscriber &subscriber);
+
+    /**
+     * Merge the subscribers appended by a match so each session appears once with its highest granted QoS.
+     *
+     * @param subscribers Container of matched subscribers.
+     * @param first       Position of the first subscriber appended by the match.
+     */
+    static void collapse(std::vector<Subscriber> &subscribers, size_t first);
+
+    /** Recursive matching helper. */
+    void match(const Node &node, const std::vector<InternedTopic::Level> &levels, size_t level,
+               std::vector<Subscriber> &subscribers) const;
+
+    /** Recursive removal helper, releases child nodes left empty and merges nodes left with a single child. */
+    bool erase(Node &node, const std::vector<InternedTopic::Level> &levels, size_t level, const Subscriber &subscriber);
+
+    /**
+     * Merge a literal node left without subscribers or wildcard children with its only literal child.
+     *
+     * @param ref Reference to the node.
+     */
+    void merge(NodeRef ref);
+
+    /** Copy the nodes below a node into a new arena and release the old one. */
+    void compact();
+
+    /** Recursive compaction helper, moves the children of a node to the new arena. */
+    void relocate(Node &node, SlabArena<Node> &arena);
+
+    /** Recursive helper for bytes_used, storage held by a node and its descendants outside the arena. */
+    size_t bytes_used(const Node &node) const;
+
+    /**
+     * Subscriptions to topic filters that either do or do not start with '$'.
+     */
+    struct Partition {
+
+        /** Subscribers to topic filters without wildcards, keyed by the topic filter id. */
+        std::unordered_map<uint32_t, ExactSubscribers> exact_subscribers;
+
+        /** Root of the topic level tree holding topic filters with wildcards. */
+        Node root;
+    };
+
+    /** Partition for a topic name or filter. */
+    Partition &partition_for(const std::string &topic) { return topic[0] == '$' ? system_topics : topics; }
+
+    const Partition &partition_for(const std::string &topic) const {
+        return topic[0] == '$' ? system_topics : topics;
+    }
+
+    /** Topic filters not starting with '$'. */
+    Partition topics;
+
+    /** Topic filters starting with '$'. */
+    Partition system_topics;
+
+    /** Tree nodes below the roots. */
+    SlabArena<Node> nodes;
+
+    /** Shared subscription groups, keyed by the id of the complete $share/<group>/<filter> topic filter. */
+    std::unordered_map<uint32_t, std::unique_ptr<SharedGroup>> shared_groups;
+
+    /** Prefixes of the topic filters with subscribers. */
+    RoutingFilter routing_filter;
+
+    /** Number of subscriptions in the index. */
+    size_t subscription_count = 0;
+};
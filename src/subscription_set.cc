@@ -0,0 +1,60 @@
+/**
+ * @file subscription_set.cc
+ */
+
+#include "subscription_set.h"
+
+bool SubscriptionSet::insert(const Subscription &subscription) {
+
+    auto position = positions.find(subscription.topic_filter.id());
+
+    if (position != positions.end()) {
+        Subscription &previous_subscription = subscriptions[position->second];
+        if (previous_subscription.qos == subscription.qos) {
+            return false;
+        }
+        previous_subscription.qos = subscription.qos;
+        return true;
+    }
+
+    positions[subscription.topic_filter.id()] = subscriptions.size();
+    subscriptions.push_back(subscription);
+    return true;
+}
+
+bool SubscriptionSet::erase(const TopicFilter &topic_filter) {
+
+    auto position = positions.find(topic_filter.id());
+
+    if (position == positions.end()) {
+        return false;
+    }
+
+    // Fill the hole with the last subscription so the vector stays contiguous
+    size_t index = position->second;
+    positions.erase(position);
+
+    if (index + 1 != subscriptions.size()) {
+        subscriptions[index] = subscriptions.back();
+        positions[subscriptions[index].topic_filter.id()] = index;
+    }
+    subscriptions.pop_back();
+
+    return true;
+}
+
+const Subscription *SubscriptionSet::find(const TopicFilter &topic_filter) const {
+
+    auto position = positions.find(topic_filter.id());
+
+    if (position == positions.end()) {
+        return nullptr;
+    }
+
+    return &subscriptions[position->second];
+}
+
+void SubscriptionSet::clear() {
+    subscriptions.clear();
+    positions.clear();
+}
@@ -0,0 +1,75 @@
+/**
+ * @file subscription_set.h
+ *
+ * Set of the subscriptions held by a session.
+ *
+ * Clients commonly resubscribe to all of their topic filters each time they connect.  Subscriptions are kept in a
+ * vector for iteration along with a hash table from interned topic filter id to vector position, so replacing or
+ * removing a subscription costs a single lookup rather than a scan of every subscription held by the session.
+ */
+
+#pragma once
+
+#include "packet.h"
+#include "topic.h"
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * SubscriptionSet class
+ *
+ * Subscriptions keyed by topic filter.  Topic filters are compared character by character, a session holds at most
+ * one subscription for each topic filter.  Iteration order is unspecified.
+ */
+class SubscriptionSet {
+public:
+
+    typedef std::vector<Subscription>::const_iterator const_iterator;
+
+    /**
+     * Add a subscription, replacing any previous subscription to the same topic filter.
+     *
+     * @param subscription Reference to the subscription.
+     * @return             The set changed, false if an identical subscription was already present.
+     */
+    bool insert(const Subscription &subscription);
+
+    /**
+     * Remove the subscription to a topic filter.
+     *
+     * @param topic_filter Subscribed topic filter.
+     * @return             A subscription was removed.
+     */
+    bool erase(const TopicFilter &topic_filter);
+
+    /**
+     * Find the subscription to a topic filter.
+     *
+     * @param topic_filter Subscribed topic filter.
+     * @return             Pointer to the subscription, nullptr if not subscribed.  Valid until the set is modified.
+     */
+    const Subscription *find(const TopicFilter &topic_filter) const;
+
+    /** Number of subscriptions. */
+    size_t size() const { return subscriptions.size(); }
+
+    /** The set holds no subscriptions. */
+    bool empty() const { return subscriptions.empty(); }
+
+    /** Remove all subscriptions. */
+    void clear();
+
+    const_iterator begin() const { return subscriptions.begin(); }
+
+    const_iterator end() const { return subscriptions.end(); }
+
+private:
+
+    /** Subscriptions in no particular order. */
+    std::vector<Subscription> subscriptions;
+
+    /** Position of each subscription in the vector, keyed by topic filter id. */
+    std::unordered_map<uint32_t, size_t> positions;
+};
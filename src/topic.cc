@@ -3,35 +3,229 @@
  */
 
 #include "topic.h"
+#include "topic_scan.h"
 
 #include <regex>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
 
-TopicName::TopicName(const std::string & s) {
-    if (!is_valid(s)) {
+namespace {
+
+    /**
+     * Allocator for small integer ids.  Released ids are reused.
+     */
+    class IdAllocator {
+    public:
+
+        uint32_t allocate() {
+            if (free_ids.empty()) {
+                return next_id++;
+            }
+            uint32_t id = free_ids.back();
+            free_ids.pop_back();
+            return id;
+        }
+
+        void release(uint32_t id) {
+            free_ids.push_back(id);
+        }
+
+    private:
+
+        uint32_t next_id = 0;
+
+        std::vector<uint32_t> free_ids;
+    };
+
+    /**
+     * Interned level string.
+     */
+    struct LevelSymbol {
+        uint32_t id;
+        size_t references;
+    };
+
+    /**
+     * Symbol table holding all interned topics and topic levels.
+     */
+    struct SymbolTable {
+
+        SymbolTable() {
+            // The wildcard levels are permanently interned with fixed ids.
+            levels["+"] = LevelSymbol{level_ids.allocate(), 1};
+            levels["#"] = LevelSymbol{level_ids.allocate(), 1};
+        }
+
+        std::mutex mutex;
+
+        std::unordered_map<std::string, std::weak_ptr<const InternedTopic>> topics;
+
+        std::unordered_map<std::string, LevelSymbol> levels;
+
+        IdAllocator topic_ids;
+
+        IdAllocator level_ids;
+    };
+
+    /**
+     * The symbol table is intentionally never destroyed, interned topics may be released by static destructors.
+     */
+    SymbolTable & symbol_table() {
+        static SymbolTable *table = new SymbolTable;
+        return *table;
+    }
+
+    /**
+     * Deleter for interned topics, removes the topic and its levels from the symbol table.
+     */
+    void release_topic(const InternedTopic *topic) {
+
+        SymbolTable &table = symbol_table();
+
+        {
+            std::lock_guard<std::mutex> lock(table.mutex);
+
+            auto entry = table.topics.find(topic->text);
+            // the string may have been interned again since the last reference was released
+            if (entry != table.topics.end() and entry->second.expired()) {
+                table.topics.erase(entry);
+            }
+            table.topic_ids.release(topic->id);
+
+            for (auto &level : topic->levels) {
+                auto symbol = table.levels.find(topic->text.substr(level.offset, level.length));
+                if (--symbol->second.references == 0) {
+                    table.level_ids.release(symbol->second.id);
+                    table.levels.erase(symbol);
+                }
+            }
+        }
+
+        delete topic;
+    }
+
+    /**
+     * Does a level contain a wildcard character.  Only the level's own bytes are searched so checking every level of
+     * a topic is a single pass over the string.
+     */
+    bool level_has_wildcard(const std::string &s, size_t offset, size_t length) {
+        const char *level = s.data() + offset;
+        return std::memchr(level, '+', length) != nullptr or std::memchr(level, '#', length) != nullptr;
+    }
+}
+
+const uint32_t InternedTopic::SingleLevelWildcard;
+const uint32_t InternedTopic::MultiLevelWildcard;
+
+std::shared_ptr<const InternedTopic> InternedTopic::intern(const std::string &s) {
+
+    SymbolTable &table = symbol_table();
+
+    std::lock_guard<std::mutex> lock(table.mutex);
+
+    std::weak_ptr<const InternedTopic> &entry = table.topics[s];
+
+    std::shared_ptr<const InternedTopic> interned_topic = entry.lock();
+    if (interned_topic) {
+        return interned_topic;
+    }
+
+    TopicScan scan;
+    scan_topic(s, scan);
+
+    InternedTopic *topic = new InternedTopic;
+    topic->text = s;
+    topic->id = table.topic_ids.allocate();
+    topic->well_formed = scan.well_formed;
+    topic->wildcards = scan.wildcards;
+    topic->valid_filter = true;
+
+    size_t start = 0;
+    for (size_t i = 0; i <= scan.separators.size(); i++) {
+        size_t end = (i < scan.separators.size()) ? scan.separators[i] : s.size();
+
+        LevelSymbol &symbol = table.levels[s.substr(start, end - start)];
+        if (symbol.references++ == 0) {
+            symbol.id = table.level_ids.allocate();
+        }
+        topic->levels.push_back(Level{static_cast<uint16_t>(start), static_cast<uint16_t>(end - start), symbol.id});
+
+        start = end + 1;
+    }
+
+    if (topic->wildcards) {
+        for (auto &level : topic->levels) {
+            if (level.id == SingleLevelWildcard) {
+                topic->program.push_back(MatchInstruction{MatchInstruction::Opcode::SingleLevel, level.id});
+            } else if (level.id == MultiLevelWildcard) {
+                topic->program.push_back(MatchInstruction{MatchInstruction::Opcode::MultiLevel, level.id});
+                if (&level != &topic->levels.back()) {
+                    topic->valid_filter = false;
+                }
+            } else {
+                topic->program.push_back(MatchInstruction{MatchInstruction::Opcode::Literal, level.id});
+                if (level_has_wildcard(s, level.offset, level.length)) {
+                    topic->valid_filter = false;
+                }
+            }
+        }
+    }
+
+    interned_topic = std::shared_ptr<const InternedTopic>(topic, release_topic);
+    entry = interned_topic;
+
+    return interned_topic;
+}
+
+TopicName::TopicName(const std::string & s) : topic(intern_name(s)) {
+    if (!topic) {
         throw std::exception();
     }
+}
+
+std::shared_ptr<const InternedTopic> TopicName::intern_name(const std::string &s) {
+    if (s.size() > MaxNameSize) {
+        return nullptr;
+    }
 
-    name = s;
+    std::shared_ptr<const InternedTopic> topic = InternedTopic::intern(s);
+
+    // An interned topic already records the result of scanning its characters, no need to scan it again.
+    if (!topic->well_formed or topic->wildcards) {
+        return nullptr;
+    }
+    return topic;
 }
 
-bool TopicName::is_valid(const std::string &s) const {
+bool TopicName::is_valid(const std::string &s) {
     if (s.size() > MaxNameSize) {
         return false;
     }
 
-    if ((s.find('+') == std::string::npos) and (s.find('#') == std::string::npos)) {
-        return true;
-    }
+    TopicScan scan;
+    scan_topic(s, scan);
 
-    return false;
+    return scan.well_formed and !scan.wildcards;
 }
 
-TopicFilter::TopicFilter(const std::string &s) {
-    if (!is_valid(s)) {
+TopicFilter::TopicFilter(const std::string &s) : topic(intern_filter(s)) {
+    if (!topic) {
         throw std::exception();
     }
+}
+
+std::shared_ptr<const InternedTopic> TopicFilter::intern_filter(const std::string &s) {
+    if (s.size() > MaxFilterSize) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const InternedTopic> topic = InternedTopic::intern(s);
 
-    filter = s;
+    if (!topic->well_formed or !topic->valid_filter) {
+        return nullptr;
+    }
+    return topic;
 }
 
 bool TopicFilter::is_valid(const std::string &s) const {
@@ -40,92 +234,83 @@ bool TopicFilter::is_valid(const std::string &s) const {
         return false;
     }
 
-    size_t pos = 0;
+    TopicScan scan;
+    scan_topic(s, scan);
 
-    for (char c : s) {
-        if (c == '+') {
-            if ((pos != 0 and s[pos - 1] != '/') or (pos + 1 != s.size() and s[pos + 1] != '/')) {
-                return false;
-            }
-        } else if (c == '#') {
-            if ((pos != 0 and s[pos - 1] != '/') or (pos + 1 != s.size())) {
+    if (!scan.well_formed) {
+        return false;
+    }
+
+    if (!scan.wildcards) {
+        return true;
+    }
+
+    size_t start = 0;
+    for (size_t i = 0; i <= scan.separators.size(); i++) {
+        size_t end = (i < scan.separators.size()) ? scan.separators[i] : s.size();
+        if (level_has_wildcard(s, start, end - start)) {
+            // A wildcard must occupy the whole level and '#' must be the last level
+            if (end - start != 1 or (s[start] == '#' and end != s.size())) {
                 return false;
             }
         }
-        pos++;
+        start = end + 1;
     }
 
     return true;
 }
 
+bool TopicFilter::has_wildcards() const {
+    return topic->wildcards;
+}
+
 bool topic_match(const TopicFilter &filter, const TopicName &name) {
 
-    const std::string &f = filter.filter;
-    const std::string &n = name.name;
+    const InternedTopic &f = *filter.topic;
+    const InternedTopic &n = *name.topic;
 
     // empty strings don't match
-    if (f.empty() or n.empty()) {
+    if (f.text.empty() or n.text.empty()) {
         return false;
     }
 
-    size_t fpos = 0;
-    size_t npos = 0;
+    if (!f.wildcards) {
+        return f.id == n.id;
+    }
+
+    typedef InternedTopic::MatchInstruction::Opcode Opcode;
 
     // Cannot match $ with wildcard
-    if ((f[fpos] == '$' and n[npos] != '$') or (f[fpos] != '$' and n[npos] == '$')) {
+    if (n.text[0] == '$' and f.program[0].opcode != Opcode::Literal) {
         return false;
     }
 
-    while (fpos < f.size() and npos < n.size()) {
+    size_t level = 0;
 
-        // filter and topic name match at the current position
-        if (f[fpos] == n[npos]) {
-
-            // last character in the topic name
-            if (npos == n.size() - 1) {
-
-                // at the end of the topic name and the filter has a separator followed by a multi-level wildcard,
-                // causing a parent level match.
-                if ((fpos == f.size() - 3) and (f[fpos + 1] == '/') and (f[fpos + 2] == '#')) {
-                    return true;
-                }
-            }
-
-            fpos++;
-            npos++;
-
-            // at the end of both the filter and topic name, match
-            if ((fpos == f.size()) && (npos == n.size())) {
+    for (auto &instruction : f.program) {
+        switch (instruction.opcode) {
+            case Opcode::MultiLevel:
                 return true;
-
-            // at the end of the topic name and the next character in the filter is wildcard.
-            } else if ((npos == n.size()) and (fpos == f.size() - 1) and (f[fpos] == '+')) {
-                return true;
-            }
-
-        } else {
-
-            if (f[fpos] == '+') {
-                fpos++;
-                while ((npos < n.size()) and (n[npos] != '/')) {
-                    npos++;
+            case Opcode::SingleLevel:
+                if (level == n.levels.size()) {
+                    return false;
                 }
-                if ((npos == n.size()) and (fpos == f.size())) {
-                    return true;
+                break;
+            case Opcode::Literal:
+                if (level == n.levels.size() or n.levels[level].id != instruction.level_id) {
+                    return false;
                 }
-            } else if (f[fpos] == '#') {
-                return true;
-            } else {
-                return false;
-            }
+                break;
         }
+        level++;
     }
 
-    return false;
+    return level == n.levels.size();
 }
 
 bool topic_match(const TopicFilter &filter1, const TopicFilter &filter2) {
 
-   return filter1.filter == filter2.filter;
+    // interned filters with the same characters are the same instance
+    return filter1.topic == filter2.topic;
 
 }
\ No newline at end of file
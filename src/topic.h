@@ -10,9 +10,106 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
 
 class TopicFilter;
 
+/**
+ * Interned topic string.
+ *
+ * Topic names and topic filters are interned into a process wide symbol table.  Every distinct topic string is stored
+ * once, along with the boundaries of its levels, and is shared by all TopicName and TopicFilter instances created
+ * from it.  Each topic and each distinct topic level string is assigned an integer id.  Ids are stable for as long as
+ * any instance refers to the topic, comparing ids is equivalent to comparing the strings.
+ *
+ * The symbol table entries are removed when the last reference is released.
+ */
+class InternedTopic {
+public:
+
+    /** Level id assigned to the single level '+' wildcard. */
+    const static uint32_t SingleLevelWildcard = 0;
+
+    /** Level id assigned to the multi level '#' wildcard. */
+    const static uint32_t MultiLevelWildcard = 1;
+
+    /**
+     * A single topic level.
+     */
+    struct Level {
+
+        /** Offset of the level in the topic string. */
+        uint16_t offset;
+
+        /** Length of the level string. */
+        uint16_t length;
+
+        /** Id assigned to the level string. */
+        uint32_t id;
+    };
+
+    /**
+     * A single topic filter matcher instruction.
+     *
+     * Topic filters containing wildcards are compiled into a program with one instruction per filter level.
+     * Instruction i is applied to level i of the topic name.
+     */
+    struct MatchInstruction {
+
+        enum class Opcode : uint8_t {
+            /** The name level must be the literal level. */
+            Literal,
+            /** Skip one name level, the '+' wildcard. */
+            SingleLevel,
+            /** Accept the remaining name levels, if any, the '#' wildcard. */
+            MultiLevel,
+        };
+
+        /** Instruction opcode. */
+        Opcode opcode;
+
+        /** Level id of a Literal instruction.  Level ids are interned, equal ids mean equal level strings. */
+        uint32_t level_id;
+    };
+
+    /**
+     * Find or add a topic string in the symbol table.
+     *
+     * The string is not validated.  It must not be longer than the MQTT 3.1.1 maximum topic length.
+     *
+     * @param topic Topic string.
+     * @return      Shared pointer to the interned topic.
+     */
+    static std::shared_ptr<const InternedTopic> intern(const std::string & topic);
+
+    /** The topic string. */
+    std::string text;
+
+    /** Topic id, unique among interned topics. */
+    uint32_t id;
+
+    /** Levels of the topic, a string without separators has a single level. */
+    std::vector<Level> levels;
+
+    /** The topic string is well formed UTF-8 without NUL characters. */
+    bool well_formed;
+
+    /** The topic string contains '+' or '#' characters. */
+    bool wildcards;
+
+    /** Every '+' or '#' character occupies a whole level and '#' is only used as the last level. */
+    bool valid_filter;
+
+    /** Compiled matcher program, only present when the topic contains wildcards. */
+    std::vector<MatchInstruction> program;
+
+private:
+
+    InternedTopic() {}
+};
+
 /**
  * Topic Name
  *
@@ -20,6 +117,8 @@ class TopicFilter;
  * class enforces that structure.  Topic names differe from topic filters in that topic filters allow wildcard
  * characters.
  *
+ * The name is interned, copies are cheap and share the validated, pre-split topic string.
+ *
  * This class friends the topic_match function.
  */
 class TopicName {
@@ -38,28 +137,66 @@ public:
      */
     TopicName(const std::string & name);
 
+    /**
+     * Constructor
+     *
+     * @param topic Shared pointer to an interned name returned by intern_name, which must not be empty.
+     */
+    explicit TopicName(std::shared_ptr<const InternedTopic> topic) : topic(std::move(topic)) {}
+
+    /**
+     * Intern a topic name string without throwing.
+     *
+     * Used when routing published messages, the name is validated against the MQTT topic name rules.
+     *
+     * @param name A reference to the topic name string.
+     * @return     Shared pointer to the interned name, empty if the name is invalid.
+     */
+    static std::shared_ptr<const InternedTopic> intern_name(const std::string & name);
+
     /**
      * Validate the topic name against the MQTT 3.1.1 standard rules.
      *
      * @param name A name string.
      * @return     Topic name is valid.
      */
-    bool is_valid(const std::string & name) const;
+    static bool is_valid(const std::string & name);
 
     /**
      * Cast an instance of this class to a std::string.
      *
      * @return std::string
      */
-    operator std::string() const {return name;}
+    operator std::string() const {return topic->text;}
+
+    /**
+     * Interned topic id.
+     *
+     * @return Id shared with every TopicName and TopicFilter with the same characters.
+     */
+    uint32_t id() const {return topic->id;}
+
+    /**
+     * Topic levels.
+     *
+     * @return Reference to the interned levels.
+     */
+    const std::vector<InternedTopic::Level> & levels() const {return topic->levels;}
+
+    /**
+     * Shared pointer to the interned name.
+     *
+     * @return Interned name.
+     */
+    const std::shared_ptr<const InternedTopic> & interned() const {return topic;}
 
     /** Matching friend function. */
     friend bool topic_match(const TopicFilter &, const TopicName &);
 
 private:
 
-    /** The name character string. */
-    std::string name;
+    /** The interned name. */
+    std::shared_ptr<const InternedTopic> topic;
 };
 
 /**
@@ -68,6 +205,8 @@ private:
  * Topic filters are composed of UTF-8 encoded character strings.  The have a structure imposed by the MQTT 3.1.1
  * standard including wildcard characters.  This class enforces that structure.
  *
+ * The filter is interned, identical filters subscribed by many sessions share a single copy of the string.
+ *
  * This class friends the topic_match function.
  */
 class TopicFilter {
@@ -86,6 +225,23 @@ public:
      */
     TopicFilter(const std::string & filter);
 
+    /**
+     * Constructor
+     *
+     * @param topic Shared pointer to an interned filter returned by intern_filter, which must not be empty.
+     */
+    explicit TopicFilter(std::shared_ptr<const InternedTopic> topic) : topic(std::move(topic)) {}
+
+    /**
+     * Intern a topic filter string without throwing.
+     *
+     * Used when decoding packets, the filter is validated against the MQTT topic filter rules.
+     *
+     * @param filter A reference to the topic filter string.
+     * @return       Shared pointer to the interned filter, empty if the filter is invalid.
+     */
+    static std::shared_ptr<const InternedTopic> intern_filter(const std::string & filter);
+
     /**
      * Validate the topic filter against the MQTT 3.1.1 standard rules.
      *
@@ -94,12 +250,46 @@ public:
      */
     bool is_valid(const std::string & filter) const;
 
+    /**
+     * Does the topic filter contain wildcard characters.
+     *
+     * A filter without wildcards only matches the topic name with the same characters.
+     *
+     * @return Has wildcards.
+     */
+    bool has_wildcards() const;
+
     /**
      * Cast an instance of this class to a std::string.
      *
      * @return std::string
      */
-    operator std::string() const {return filter;}
+    operator std::string() const {return topic->text;}
+
+    /**
+     * Interned topic id.
+     *
+     * @return Id shared with every TopicName and TopicFilter with the same characters.
+     */
+    uint32_t id() const {return topic->id;}
+
+    /**
+     * Topic levels.
+     *
+     * Wildcard levels have the InternedTopic::SingleLevelWildcard and InternedTopic::MultiLevelWildcard ids.
+     *
+     * @return Reference to the interned levels.
+     */
+    const std::vector<InternedTopic::Level> & levels() const {return topic->levels;}
+
+    /**
+     * Shared pointer to the interned filter.
+     *
+     * Holding the pointer keeps the topic and level ids of this filter from being reused.
+     *
+     * @return Interned filter.
+     */
+    const std::shared_ptr<const InternedTopic> & interned() const {return topic;}
 
     /** Matching friend function. */
     friend bool topic_match(const TopicFilter &, const TopicName &);
@@ -109,14 +299,16 @@ public:
 
 private:
 
-    /** The filter character string. */
-    std::string filter;
+    /** The interned filter. */
+    std::shared_ptr<const InternedTopic> topic;
 };
 
 /**
  * Match a TopicFilter against a TopicName.
  *
- * The MQTT 3.1.1 standard topic filter matching rules will be applied including wildcard characters.
+ * The MQTT 3.1.1 standard topic filter matching rules will be applied including wildcard characters.  A filter without
+ * wildcards matches by comparing topic ids, otherwise the compiled filter program is run against the pre-split name
+ * levels.
  *
  * @param topic_filter A reference to a TopicFilter.
  * @param topic_name   A reference to a TopicName
@@ -0,0 +1,240 @@
+/**
+ * @file topic_scan.cc
+ */
+
+#include "topic_scan.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TOPIC_SCAN_AVX2
+#endif
+
+/**
+ * Validate a UTF-8 byte sequence.
+ *
+ * Overlong encodings, surrogate code points and code points beyond U+10FFFF are rejected.
+ *
+ * @param s   Pointer to the sequence.
+ * @param len Length of the sequence.
+ * @return    Sequence is well formed.
+ */
+static bool valid_utf8(const uint8_t *s, size_t len) {
+
+    size_t i = 0;
+
+    while (i < len) {
+
+        uint8_t c = s[i];
+
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        size_t continuation;
+        uint8_t lower = 0x80;
+        uint8_t upper = 0xBF;
+
+        if (c >= 0xC2 and c <= 0xDF) {
+            continuation = 1;
+        } else if (c >= 0xE0 and c <= 0xEF) {
+            continuation = 2;
+            if (c == 0xE0) {
+                lower = 0xA0;
+            } else if (c == 0xED) {
+                upper = 0x9F;
+            }
+        } else if (c >= 0xF0 and c <= 0xF4) {
+            continuation = 3;
+            if (c == 0xF0) {
+                lower = 0x90;
+            } else if (c == 0xF4) {
+                upper = 0x8F;
+            }
+        } else {
+            return false;
+        }
+
+        if (i + continuation >= len) {
+            return false;
+        }
+
+        if (s[i + 1] < lower or s[i + 1] > upper) {
+            return false;
+        }
+
+        for (size_t j = 2; j <= continuation; j++) {
+            if ((s[i + j] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+
+        i += continuation + 1;
+    }
+
+    return true;
+}
+
+/**
+ * Scalar scan of a byte range, shared by all implementations for the bytes left over after the last full vector.
+ *
+ * @param s         Pointer to the topic string.
+ * @param begin     First offset to scan.
+ * @param end       Offset past the last byte to scan.
+ * @param scan      Reference to the result.
+ * @param non_ascii Set when a byte with the high bit set is found.
+ */
+static void scan_bytes(const uint8_t *s, size_t begin, size_t end, TopicScan &scan, bool &non_ascii) {
+
+    for (size_t i = begin; i < end; i++) {
+        uint8_t c = s[i];
+        if (c == '/') {
+            scan.separators.push_back(static_cast<uint16_t>(i));
+        } else if (c == '+' or c == '#') {
+            scan.wildcards = true;
+        } else if (c == 0) {
+            scan.well_formed = false;
+        } else if (c & 0x80) {
+            non_ascii = true;
+        }
+    }
+}
+
+/**
+ * Append the separator offsets marked in a vector comparison mask.
+ */
+static inline void add_separators(uint32_t mask, size_t offset, TopicScan &scan) {
+    while (mask) {
+        scan.separators.push_back(static_cast<uint16_t>(offset + __builtin_ctz(mask)));
+        mask &= mask - 1;
+    }
+}
+
+/**
+ * Complete a scan once all bytes have been examined.  UTF-8 decoding is only needed when non-ASCII bytes were seen.
+ */
+static void finish_scan(const uint8_t *s, size_t len, bool non_ascii, TopicScan &scan) {
+    if (non_ascii and scan.well_formed) {
+        scan.well_formed = valid_utf8(s, len);
+    }
+}
+
+void scan_topic_scalar(const std::string &topic, TopicScan &scan) {
+
+    const uint8_t *s = reinterpret_cast<const uint8_t *>(topic.data());
+
+    scan.well_formed = true;
+    scan.wildcards = false;
+    scan.separators.clear();
+
+    bool non_ascii = false;
+    scan_bytes(s, 0, topic.size(), scan, non_ascii);
+
+    finish_scan(s, topic.size(), non_ascii, scan);
+}
+
+#if defined(__SSE2__)
+
+static void scan_topic_sse2(const std::string &topic, TopicScan &scan) {
+
+    const uint8_t *s = reinterpret_cast<const uint8_t *>(topic.data());
+    const size_t len = topic.size();
+
+    scan.well_formed = true;
+    scan.wildcards = false;
+    scan.separators.clear();
+
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i zero = _mm_setzero_si128();
+
+    int wildcards = 0;
+    int nul = 0;
+    int high = 0;
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+
+        add_separators(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, slash))), i, scan);
+
+        wildcards |= _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, plus), _mm_cmpeq_epi8(v, hash)));
+        nul |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        high |= _mm_movemask_epi8(v);
+    }
+
+    scan.wildcards = wildcards != 0;
+    scan.well_formed = nul == 0;
+
+    bool non_ascii = high != 0;
+    scan_bytes(s, i, len, scan, non_ascii);
+
+    finish_scan(s, len, non_ascii, scan);
+}
+
+#endif
+
+#if defined(TOPIC_SCAN_AVX2)
+
+__attribute__((target("avx2")))
+static void scan_topic_avx2(const std::string &topic, TopicScan &scan) {
+
+    const uint8_t *s = reinterpret_cast<const uint8_t *>(topic.data());
+    const size_t len = topic.size();
+
+    scan.well_formed = true;
+    scan.wildcards = false;
+    scan.separators.clear();
+
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i plus = _mm256_set1_epi8('+');
+    const __m256i hash = _mm256_set1_epi8('#');
+    const __m256i zero = _mm256_setzero_si256();
+
+    int wildcards = 0;
+    int nul = 0;
+    int high = 0;
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+
+        add_separators(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, slash))), i, scan);
+
+        wildcards |= _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, plus), _mm256_cmpeq_epi8(v, hash)));
+        nul |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+        high |= _mm256_movemask_epi8(v);
+    }
+
+    scan.wildcards = wildcards != 0;
+    scan.well_formed = nul == 0;
+
+    bool non_ascii = high != 0;
+    scan_bytes(s, i, len, scan, non_ascii);
+
+    finish_scan(s, len, non_ascii, scan);
+}
+
+#endif
+
+void scan_topic(const std::string &topic, TopicScan &scan) {
+
+#if defined(TOPIC_SCAN_AVX2)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        scan_topic_avx2(topic, scan);
+        return;
+    }
+#endif
+
+#if defined(__SSE2__)
+    scan_topic_sse2(topic, scan);
+#else
+    scan_topic_scalar(topic, scan);
+#endif
+}
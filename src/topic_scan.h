@@ -0,0 +1,51 @@
+/**
+ * @file topic_scan.h
+ *
+ * Single pass validation and level splitting of topic strings.
+ *
+ * Topic names and filters are scanned once when they are interned.  The scan checks the MQTT 3.1.1 requirement that
+ * topic strings are well formed UTF-8 without NUL characters, notes whether wildcard characters are present and
+ * records the offsets of the '/' level separators.  The scan processes 32 or 16 bytes at a time using AVX2 or SSE2
+ * instructions when the processor supports them.  A portable scalar version is used otherwise.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Result of scanning a topic string.
+ */
+struct TopicScan {
+
+    /** The string is well formed UTF-8 and contains no NUL characters. */
+    bool well_formed;
+
+    /** The string contains '+' or '#' characters. */
+    bool wildcards;
+
+    /** Offsets of the '/' level separators in ascending order. */
+    std::vector<uint16_t> separators;
+};
+
+/**
+ * Scan a topic string.
+ *
+ * The string must not be longer than the MQTT 3.1.1 maximum topic length so separator offsets fit 16 bits.
+ *
+ * @param topic Topic string.
+ * @param scan  Reference to the result, any previous separators are cleared.
+ */
+void scan_topic(const std::string & topic, TopicScan & scan);
+
+/**
+ * Scan a topic string using only portable scalar code.
+ *
+ * Produces the same result as scan_topic.  Exposed so the vector implementations can be checked against it.
+ *
+ * @param topic Topic string.
+ * @param scan  Reference to the result, any previous separators are cleared.
+ */
+void scan_topic_scalar(const std::string & topic, TopicScan & scan);
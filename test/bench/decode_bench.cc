@@ -0,0 +1,116 @@
+/**
+ * @file decode_bench.cc
+ *
+ * Benchmark of rejecting malformed control packets.
+ *
+ * A stream of malformed packets of one kind is decoded repeatedly.  For each kind the benchmark reports the CPU time
+ * per rejected packet of two decode paths.
+ *
+ * throw   The packet constructor accepting a view, which throws on a malformed packet, with the exception caught by
+ *         the caller as received packets were decoded before the decode status API.
+ * status  decode_packet, which reports the malformed packet through a DecodeStatus without throwing.
+ *
+ * Usage: decode_bench [packets]
+ */
+
+#include "packet.h"
+#include "packet_dispatch.h"
+#include "packet_arena.h"
+
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/** A kind of malformed packet. */
+struct Malformed {
+    const char *name;
+    std::vector<uint8_t> packet_data;
+};
+
+/**
+ * Decode through the throwing constructor of the packet type.
+ */
+static bool decode_throwing(const PacketDataView &packet_data) {
+
+    try {
+        switch (static_cast<PacketType>(packet_data[0] >> 4)) {
+            case PacketType::Publish:
+                PublishPacket{packet_data};
+                break;
+            case PacketType::Puback:
+                PubackPacket{packet_data};
+                break;
+            case PacketType::Subscribe:
+                SubscribePacket{packet_data};
+                break;
+            case PacketType::Pingreq:
+                PingreqPacket{packet_data};
+                break;
+            default:
+                return false;
+        }
+    } catch (std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * CPU nanoseconds per packet of one decode path.
+ */
+static double run(const Malformed &malformed, size_t packets, bool status) {
+
+    PacketArena arena;
+    size_t rejected = 0;
+
+    std::clock_t start = std::clock();
+
+    for (size_t i = 0; i < packets; i++) {
+        if (status) {
+            const Packet *packet;
+            if (decode_packet(malformed.packet_data, arena, packet) != DecodeStatus::Ok) {
+                rejected++;
+            }
+            // As the PacketManager does after each read callback
+            if (i % 64 == 63) {
+                arena.reset();
+            }
+        } else if (!decode_throwing(malformed.packet_data)) {
+            rejected++;
+        }
+    }
+
+    std::clock_t elapsed = std::clock() - start;
+
+    if (rejected != packets) {
+        std::fprintf(stderr, "%s: %zu of %zu packets rejected\n", malformed.name, rejected, packets);
+        std::exit(1);
+    }
+
+    return 1e9 * elapsed / CLOCKS_PER_SEC / packets;
+}
+
+int main(int argc, char *argv[]) {
+
+    size_t packets = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+
+    std::vector<Malformed> kinds = {
+            {"bad flags", {0xC1, 0x00}},
+            {"length mismatch", {0x40, 0x03, 0x00, 0x01}},
+            {"truncated", {0x40, 0x01, 0x00}},
+            {"truncated string", {0x30, 0x06, 0x00, 0x40, 'a', '/', 'b', 'c'}},
+            {"invalid topic", {0x82, 0x08, 0x00, 0x01, 0x00, 0x03, '#', '/', 'a', 0x00}},
+    };
+
+    std::printf("%zu packets per kind\n", packets);
+    std::printf("%18s %16s %16s\n", "kind", "throw ns/pkt", "status ns/pkt");
+
+    for (auto &malformed : kinds) {
+        double throwing = run(malformed, packets, false);
+        double status = run(malformed, packets, true);
+        std::printf("%18s %16.1f %16.1f\n", malformed.name, throwing, status);
+    }
+
+    return 0;
+}
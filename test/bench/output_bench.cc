@@ -0,0 +1,136 @@
+/**
+ * @file output_bench.cc
+ *
+ * Benchmark of the publish output path.
+ *
+ * A message is fanned out to a number of subscribers through PacketManager output buffers.  For each payload size the
+ * benchmark reports the bytes copied per delivered message and the time per delivery of two output paths.
+ *
+ * copy       Serialize the packet into a packet_data_t container and bufferevent_write it, the path used for all packets
+ *            before publish payloads were sent by reference.
+ * reference  PacketManager::send_packet, the shared wire header is copied into the output buffer and larger payloads
+ *            are referenced in the message.
+ *
+ * Bytes copied counts every byte written by the path: the serialized container and every output buffer byte that is
+ * not the message payload itself, plus the wire header encoded once per message for the reference path.
+ *
+ * Usage: output_bench [subscribers] [rounds]
+ */
+
+#include "packet.h"
+#include "packet_manager.h"
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+/**
+ * Count the bytes in an output buffer that were copied rather than referenced in the message payload.
+ */
+static size_t copied_bytes(struct evbuffer *output, const std::vector<uint8_t> &payload) {
+
+    int extent_count = evbuffer_peek(output, -1, nullptr, nullptr, 0);
+    std::vector<struct evbuffer_iovec> extents(extent_count);
+    evbuffer_peek(output, -1, nullptr, extents.data(), extent_count);
+
+    size_t copied = 0;
+    for (auto &extent : extents) {
+        const uint8_t *base = static_cast<const uint8_t *>(extent.iov_base);
+        if (base < payload.data() or base >= payload.data() + payload.size()) {
+            copied += extent.iov_len;
+        }
+    }
+    return copied;
+}
+
+/** Result of one benchmark run. */
+struct Result {
+    double copied_per_message;
+    double ns_per_message;
+};
+
+static Result run(std::vector<std::unique_ptr<PacketManager>> &packet_managers, size_t payload_size, size_t rounds,
+                  bool reference) {
+
+    auto message = std::make_shared<Message>("bench/output", std::vector<uint8_t>(payload_size, 'x'));
+
+    size_t copied = 0;
+    std::chrono::nanoseconds elapsed(0);
+
+    for (size_t round = 0; round < rounds; round++) {
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (auto &packet_manager : packet_managers) {
+
+            PublishPacket packet;
+            packet.message = message;
+            packet.qos(QoSType::QoS1);
+            packet.packet_id = packet_manager->next_packet_id();
+
+            if (reference) {
+                packet_manager->send_packet(packet);
+            } else {
+                packet_data_t packet_data = packet.serialize();
+                bufferevent_write(packet_manager->bev, packet_data.data(), packet_data.size());
+                copied += packet_data.size();
+            }
+        }
+
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        for (auto &packet_manager : packet_managers) {
+            struct evbuffer *output = bufferevent_get_output(packet_manager->bev);
+            copied += copied_bytes(output, message->payload);
+            // Stand in for the socket write, the bufferevent freezes the start of its output buffer
+            evbuffer_unfreeze(output, 1);
+            evbuffer_drain(output, evbuffer_get_length(output));
+            evbuffer_freeze(output, 1);
+        }
+    }
+
+    // The wire header is encoded once for the message, by the first delivery
+    if (reference) {
+        copied += message->wire_header(true).size();
+    }
+
+    double deliveries = static_cast<double>(rounds * packet_managers.size());
+
+    return Result{copied / deliveries, elapsed.count() / deliveries};
+}
+
+int main(int argc, char *argv[]) {
+
+    size_t subscribers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20;
+
+    struct event_base *evbase = event_base_new();
+
+    {
+        std::vector<std::unique_ptr<PacketManager>> packet_managers;
+        for (size_t i = 0; i < subscribers; i++) {
+            packet_managers.emplace_back(new PacketManager(bufferevent_socket_new(evbase, -1, 0)));
+        }
+
+        std::printf("%zu subscribers, %zu rounds\n", subscribers, rounds);
+        std::printf("%10s %18s %18s %14s %14s\n", "payload", "copy bytes/msg", "ref bytes/msg", "copy ns/msg",
+                    "ref ns/msg");
+
+        for (size_t payload_size : {64, 512, 1024, 2048, 4096, 65536}) {
+            Result copy = run(packet_managers, payload_size, rounds, false);
+            Result reference = run(packet_managers, payload_size, rounds, true);
+            std::printf("%10zu %18.1f %18.1f %14.1f %14.1f\n", payload_size, copy.copied_per_message,
+                        reference.copied_per_message, copy.ns_per_message, reference.ns_per_message);
+        }
+    }
+
+    event_base_free(evbase);
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "gtest/gtest.h"
+
+#include "concurrent_subscription_index.h"
+#include "session_manager.h"
+#include "broker_session.h"
+
+#include <event2/bufferevent.h>
+
+#include <atomic>
+#include <thread>
+#include <random>
+#include <algorithm>
+
+// The index never dereferences session pointers outside least inflight selection, distinct addresses are enough.
+static BrokerSession *const stable_session = reinterpret_cast<BrokerSession *>(0x10);
+static BrokerSession *const churn_session = reinterpret_cast<BrokerSession *>(0x20);
+static BrokerSession *const group_sessions[] = {reinterpret_cast<BrokerSession *>(0x30),
+                                                reinterpret_cast<BrokerSession *>(0x40)};
+
+TEST(concurrent_subscription_index, insert_erase_and_match) {
+
+    ConcurrentSubscriptionIndex index;
+
+    index.insert(stable_session, Subscription{TopicFilter("a/+/c"), QoSType::QoS1});
+    index.insert(group_sessions[0], Subscription{TopicFilter("$share/g/a/#"), QoSType::QoS0});
+    index.insert(group_sessions[1], Subscription{TopicFilter("$share/g/a/#"), QoSType::QoS0});
+    ASSERT_EQ(index.size(), static_cast<size_t>(3));
+
+    std::vector<Subscriber> subscribers;
+    index.match(TopicName("a/b/c"), ShareStrategy::RoundRobin, subscribers);
+    ASSERT_EQ(subscribers.size(), static_cast<size_t>(2));
+    for (auto &subscriber : subscribers) {
+        ASSERT_NE(subscriber.session, nullptr);
+        ASSERT_EQ(subscriber.group, nullptr);
+    }
+
+    ASSERT_TRUE(index.erase(stable_session, TopicFilter("a/+/c")));
+    ASSERT_FALSE(index.erase(stable_session, TopicFilter("a/+/c")));
+    ASSERT_EQ(index.size(), static_cast<size_t>(2));
+}
+
+TEST(concurrent_subscription_index, readers_during_churn) {
+
+    ConcurrentSubscriptionIndex index;
+
+    // Always present, every reader must see exactly these recipients whatever the writer is doing
+    index.insert(stable_session, Subscription{TopicFilter("sensors/+/temperature"), QoSType::QoS1});
+    index.insert(group_sessions[0], Subscription{TopicFilter("$share/g/sensors/#"), QoSType::QoS0});
+    index.insert(group_sessions[1], Subscription{TopicFilter("$share/g/sensors/#"), QoSType::QoS0});
+
+    std::atomic<bool> done{false};
+    std::atomic<long> lookups{0};
+    std::atomic<long> failures{0};
+
+    auto reader = [&]() {
+        TopicName name("sensors/s1/temperature");
+        std::vector<Subscriber> subscribers;
+        while (!done.load()) {
+            subscribers.clear();
+            index.match(name, ShareStrategy::RoundRobin, subscribers);
+
+            size_t stable = std::count_if(subscribers.begin(), subscribers.end(),
+                                          [](const Subscriber &s) { return s.session == stable_session; });
+            size_t group = std::count_if(subscribers.begin(), subscribers.end(), [](const Subscriber &s) {
+                return s.session == group_sessions[0] or s.session == group_sessions[1];
+            });
+            size_t churn = std::count_if(subscribers.begin(), subscribers.end(),
+                                         [](const Subscriber &s) { return s.session == churn_session; });
+
+            if (stable != 1 or group != 1 or churn > 1 or subscribers.size() != stable + group + churn) {
+                failures++;
+            }
+            lookups++;
+
+            // Leave the processor to the writer on machines with few cores
+            std::this_thread::yield();
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back(reader);
+    }
+
+    const std::vector<std::string> filters = {"sensors/#", "sensors/s1/+", "+/s1/temperature", "sensors/s1/temperature",
+                                              "sensors/s2/+", "other/#"};
+    std::mt19937 random(1);
+    std::vector<bool> subscribed(filters.size());
+
+    while (lookups.load() == 0) {
+        std::this_thread::yield();
+    }
+    long lookups_before_churn = lookups.load();
+
+    for (int i = 0; i < 2000; i++) {
+        size_t f = random() % filters.size();
+        if (subscribed[f]) {
+            ASSERT_TRUE(index.erase(churn_session, TopicFilter(filters[f])));
+        } else {
+            index.insert(churn_session, Subscription{TopicFilter(filters[f]), QoSType::QoS0});
+        }
+        subscribed[f] = !subscribed[f];
+        std::this_thread::yield();
+    }
+
+    long lookups_during_churn = lookups.load() - lookups_before_churn;
+
+    done.store(true);
+    for (auto &thread : readers) {
+        thread.join();
+    }
+
+    ASSERT_EQ(failures.load(), 0);
+    ASSERT_GT(lookups_during_churn, 0);
+    ASSERT_EQ(index.size(), static_cast<size_t>(3 + std::count(subscribed.begin(), subscribed.end(), true)));
+}
+
+TEST(concurrent_subscription_index, least_inflight_during_deliveries) {
+
+    struct event_base *evloop = event_base_new();
+    ASSERT_NE(evloop, nullptr);
+
+    {
+        SessionManager session_manager;
+        std::vector<std::unique_ptr<BrokerSession>> members;
+        ConcurrentSubscriptionIndex index;
+        for (int i = 0; i < 2; i++) {
+            members.emplace_back(new BrokerSession(bufferevent_socket_new(evloop, -1, 0), session_manager));
+            index.insert(members.back().get(), Subscription{TopicFilter("$share/g/sensors/#"), QoSType::QoS1});
+        }
+
+        std::atomic<bool> done{false};
+        std::atomic<long> lookups{0};
+        std::atomic<long> failures{0};
+
+        // Readers choose the least loaded member while the loop thread delivers to and acknowledges the members
+        auto reader = [&]() {
+            TopicName name("sensors/s1/temperature");
+            std::vector<Subscriber> subscribers;
+            while (!done.load()) {
+                subscribers.clear();
+                index.match(name, ShareStrategy::LeastInflight, subscribers);
+                if (subscribers.size() != 1 or
+                    (subscribers[0].session != members[0].get() and subscribers[0].session != members[1].get())) {
+                    failures++;
+                }
+                lookups++;
+                std::this_thread::yield();
+            }
+        };
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; i++) {
+            readers.emplace_back(reader);
+        }
+
+        while (lookups.load() == 0) {
+            std::this_thread::yield();
+        }
+
+        PublishPacket packet;
+        packet.message = std::make_shared<Message>("sensors/s1/temperature", std::vector<uint8_t>(16, 'x'));
+
+        std::mt19937 random(1);
+        for (int i = 0; i < 2000; i++) {
+            BrokerSession &member = *members[random() % members.size()];
+            if (member.qos1_pending_puback.size() < 4) {
+                member.forward_packet(packet, QoSType::QoS1);
+            } else {
+                PubackPacket puback;
+                puback.packet_id = member.qos1_pending_puback[0].packet_id;
+                member.handle_puback(puback);
+            }
+            std::this_thread::yield();
+        }
+
+        done.store(true);
+        for (auto &thread : readers) {
+            thread.join();
+        }
+
+        ASSERT_EQ(failures.load(), 0);
+        for (auto &member : members) {
+            ASSERT_EQ(member->qos1_inflight.load(), member->qos1_pending_puback.size());
+        }
+
+        // With the loop quiet the member with fewer messages waiting for Puback is chosen
+        while (members[1]->qos1_pending_puback.size() <= members[0]->qos1_pending_puback.size()) {
+            members[1]->forward_packet(packet, QoSType::QoS1);
+        }
+        std::vector<Subscriber> subscribers;
+        index.match(TopicName("sensors/s1/temperature"), ShareStrategy::LeastInflight, subscribers);
+        ASSERT_EQ(subscribers.size(), static_cast<size_t>(1));
+        ASSERT_EQ(subscribers[0].session, members[0].get());
+    }
+
+    event_base_free(evloop);
+}
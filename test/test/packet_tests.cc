@@ -5,6 +5,12 @@
 #include "gtest/gtest.h"
 
 #include "packet.h"
+#include "packet_manager.h"
+#include "packet_dispatch.h"
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
 
 TEST(packets, read_remaining_length) {
 
@@ -93,6 +99,70 @@ TEST(packets, write_remaining_length) {
 
 }
 
+TEST(packets, remaining_length_size) {
+
+    std::vector<std::pair<size_t, size_t>> sizes = {
+            {0, 1}, {127, 1}, {128, 2}, {16383, 2}, {16384, 3}, {2097151, 3}, {2097152, 4}, {268435455, 4},
+    };
+
+    for (auto &size : sizes) {
+        std::vector<uint8_t> packet_data(4);
+        PacketDataWriter writer(packet_data);
+        writer.write_remaining_length(size.first);
+        ASSERT_EQ(PacketDataWriter::remaining_length_size(size.first), size.second);
+        ASSERT_EQ(writer.get_offset(), size.second);
+    }
+}
+
+TEST(packets, encode_to_preallocated_memory) {
+
+    ConnectPacket connect_packet;
+    connect_packet.client_id = "client";
+    connect_packet.will_flag(true);
+    connect_packet.will_topic = "will";
+    connect_packet.will_message = {1, 2, 3};
+    connect_packet.username_flag(true);
+    connect_packet.username = "user";
+
+    PublishPacket publish_packet;
+    publish_packet.message = std::make_shared<Message>("a/b", std::vector<uint8_t>(200, 'x'));
+    publish_packet.qos(QoSType::QoS1);
+    publish_packet.packet_id = 9;
+
+    SubscribePacket subscribe_packet;
+    subscribe_packet.packet_id = 3;
+    subscribe_packet.subscriptions.push_back(Subscription{TopicFilter("a/+"), QoSType::QoS1});
+    subscribe_packet.subscriptions.push_back(Subscription{TopicFilter("b/#"), QoSType::QoS2});
+
+    SubackPacket suback_packet;
+    suback_packet.packet_id = 3;
+    suback_packet.return_codes = {SubackPacket::ReturnCode::SuccessQoS1, SubackPacket::ReturnCode::Failure};
+
+    UnsubscribePacket unsubscribe_packet;
+    unsubscribe_packet.packet_id = 4;
+    unsubscribe_packet.topics = {"a/+", "b/#"};
+
+    PubackPacket puback_packet;
+    puback_packet.packet_id = 5;
+
+    PingreqPacket pingreq_packet;
+
+    std::vector<const Packet *> packets = {&connect_packet, &publish_packet, &subscribe_packet, &suback_packet,
+                                           &unsubscribe_packet, &puback_packet, &pingreq_packet};
+
+    for (const Packet *packet : packets) {
+
+        // Encoding writes exactly encoded_size() bytes
+        size_t encoded_size = packet->encoded_size();
+        std::vector<uint8_t> memory(encoded_size + 8, 0xAA);
+        packet->encode_to(&memory[4]);
+
+        ASSERT_EQ(std::vector<uint8_t>(memory.begin(), memory.begin() + 4), std::vector<uint8_t>(4, 0xAA));
+        ASSERT_EQ(std::vector<uint8_t>(memory.end() - 4, memory.end()), std::vector<uint8_t>(4, 0xAA));
+        ASSERT_EQ(std::vector<uint8_t>(memory.begin() + 4, memory.end() - 4), packet->serialize());
+    }
+}
+
 TEST(packets, connect_packet) {
 
     ConnectPacket connect_packet1;
@@ -158,9 +228,8 @@ TEST(packets, publish_packet) {
     publish_packet1.qos(QoSType::QoS2);
     publish_packet1.retain(true);
 
-    publish_packet1.topic_name = "test_topic";
+    publish_packet1.message = std::make_shared<Message>("test_topic", std::vector<uint8_t>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
     publish_packet1.packet_id = 100;
-    publish_packet1.message_data = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
 
     std::vector<uint8_t> packet_data = publish_packet1.serialize();
 
@@ -169,12 +238,53 @@ TEST(packets, publish_packet) {
     ASSERT_EQ(publish_packet2.dup(), publish_packet1.dup());
     ASSERT_EQ(publish_packet2.qos(), publish_packet1.qos());
     ASSERT_EQ(publish_packet2.retain(), publish_packet1.retain());
-    ASSERT_EQ(publish_packet2.topic_name, publish_packet1.topic_name);
+    ASSERT_EQ(publish_packet2.topic_name(), publish_packet1.topic_name());
     ASSERT_EQ(publish_packet2.packet_id, publish_packet1.packet_id);
-    ASSERT_EQ(publish_packet2.message_data, publish_packet1.message_data);
+    ASSERT_EQ(publish_packet2.message_data(), publish_packet1.message_data());
 
 }
 
+TEST(packets, publish_wire_header) {
+
+    // Payloads above 64KB need a remaining length wider than 16 bits
+    auto message = std::make_shared<Message>("a/b", std::vector<uint8_t>(70000, 'x'));
+
+    const packet_data_t &header = message->wire_header(true);
+    ASSERT_EQ(&message->wire_header(true), &header);
+    ASSERT_NE(&message->wire_header(false), &header);
+
+    // The header stops where the payload starts, the payload is only held by the message
+    ASSERT_EQ(header.size(), static_cast<size_t>(1 + 3 + 5 + 2));
+    ASSERT_EQ(message->wire_header(false).size(), static_cast<size_t>(1 + 3 + 5));
+
+    for (uint16_t packet_id : {1, 2, 0x1234}) {
+        for (QoSType qos : {QoSType::QoS0, QoSType::QoS1, QoSType::QoS2}) {
+
+            PublishPacket publish_packet1;
+            publish_packet1.message = message;
+            publish_packet1.qos(qos);
+            publish_packet1.dup(packet_id == 2);
+            publish_packet1.packet_id = packet_id;
+
+            PublishPacket publish_packet2(publish_packet1.serialize());
+
+            ASSERT_EQ(publish_packet2.header_flags, publish_packet1.header_flags);
+            ASSERT_EQ(publish_packet2.topic_name(), "a/b");
+            ASSERT_EQ(publish_packet2.message_data(), message->payload);
+            if (qos != QoSType::QoS0) {
+                ASSERT_EQ(publish_packet2.packet_id, packet_id);
+            }
+        }
+    }
+
+    // Patching each delivery leaves the shared header untouched
+    ASSERT_EQ(header[0], static_cast<uint8_t>(PacketType::Publish) << 4);
+    PublishPacket publish_packet;
+    publish_packet.message = message;
+    ASSERT_EQ(header[publish_packet.packet_id_offset(header)], 0);
+    ASSERT_EQ(header[publish_packet.packet_id_offset(header) + 1], 0);
+}
+
 TEST(packets, puback_packet) {
 
     PubackPacket puback_packet1;
@@ -358,3 +468,522 @@ TEST(packets, disconnect_packet) {
     ASSERT_EQ(disconnect_packet2.type, disconnect_packet1.type);
 
 }
+
+TEST(packets, parse_from_view) {
+
+    PublishPacket publish_packet1;
+    publish_packet1.message = std::make_shared<Message>("a/b", std::vector<uint8_t>{1, 2, 3});
+
+    std::vector<uint8_t> packet_data = publish_packet1.serialize();
+
+    // Surround the packet with other bytes, parsing must stay inside the view.
+    std::vector<uint8_t> buffer(4, 0xFF);
+    buffer.insert(buffer.end(), packet_data.begin(), packet_data.end());
+    buffer.resize(buffer.size() + 4, 0xFF);
+
+    PublishPacket publish_packet2(PacketDataView(&buffer[4], packet_data.size()));
+    ASSERT_EQ(publish_packet2.topic_name(), publish_packet1.topic_name());
+    ASSERT_EQ(publish_packet2.message_data(), publish_packet1.message_data());
+
+    // A truncated view is rejected rather than read past.
+    ASSERT_THROW(PublishPacket(PacketDataView(&buffer[4], packet_data.size() - 1)), std::exception);
+    ASSERT_THROW(PubackPacket(PacketDataView(&buffer[4], 1)), std::exception);
+}
+
+TEST(packets, framing_across_chains) {
+
+    struct event_base *evbase = event_base_new();
+    struct bufferevent *pair[2];
+    bufferevent_pair_new(evbase, 0, pair);
+
+    std::vector<PublishPacket> received;
+
+    {
+        PacketManager packet_manager(pair[0]);
+        packet_manager.set_packet_received_handler([&received](const Packet &packet) {
+            received.push_back(dynamic_cast<const PublishPacket &>(packet));
+        });
+
+        // Remaining lengths above 255 take a two byte encoding.
+        PublishPacket large;
+        std::vector<uint8_t> large_payload(300);
+        for (size_t i = 0; i < large_payload.size(); i++) {
+            large_payload[i] = static_cast<uint8_t>(i);
+        }
+        large.message = std::make_shared<Message>("large", large_payload);
+
+        PublishPacket small;
+        small.message = std::make_shared<Message>("small", std::vector<uint8_t>{42});
+
+        // Deliver packets a byte at a time so headers and bodies are split across input chains, then deliver several
+        // packets in one write.
+        std::vector<uint8_t> large_data = large.serialize();
+        for (uint8_t byte : large_data) {
+            bufferevent_write(pair[1], &byte, 1);
+            event_base_loop(evbase, EVLOOP_NONBLOCK);
+        }
+
+        std::vector<uint8_t> batch;
+        for (int i = 0; i < 3; i++) {
+            std::vector<uint8_t> small_data = small.serialize();
+            batch.insert(batch.end(), small_data.begin(), small_data.end());
+        }
+        batch.insert(batch.end(), large_data.begin(), large_data.end());
+        bufferevent_write(pair[1], batch.data(), batch.size());
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+        ASSERT_EQ(received.size(), static_cast<size_t>(5));
+        for (size_t i = 0; i < received.size(); i++) {
+            const PublishPacket &packet = received[i];
+            const PublishPacket &expected = (i == 0 or i == 4) ? large : small;
+            ASSERT_EQ(packet.topic_name(), expected.topic_name());
+            ASSERT_EQ(packet.message_data(), expected.message_data());
+        }
+        ASSERT_EQ(evbuffer_get_length(bufferevent_get_input(pair[0])), static_cast<size_t>(0));
+    }
+
+    bufferevent_free(pair[1]);
+    event_base_free(evbase);
+}
+
+TEST(packets, publish_payload_referenced) {
+
+    struct event_base *evbase = event_base_new();
+
+    {
+        PacketManager packet_manager(bufferevent_socket_new(evbase, -1, 0));
+        struct evbuffer *output = bufferevent_get_output(packet_manager.bev);
+
+        for (size_t payload_size : {PacketManager::ReferenceThreshold - 1, PacketManager::ReferenceThreshold}) {
+
+            auto message = std::make_shared<Message>("a/b", std::vector<uint8_t>(payload_size, 'x'));
+            const std::vector<uint8_t> &payload = message->payload;
+            size_t header_size = message->wire_header(true).size();
+
+            PublishPacket publish_packet1;
+            publish_packet1.message = message;
+            publish_packet1.qos(QoSType::QoS1);
+            publish_packet1.packet_id = 7;
+
+            packet_manager.send_packet(publish_packet1);
+
+            bool referenced = payload_size >= PacketManager::ReferenceThreshold;
+            ASSERT_EQ(message.use_count(), referenced ? 3 : 2);
+
+            // Only the header is copied when the payload is referenced in the message
+            int extent_count = evbuffer_peek(output, -1, nullptr, nullptr, 0);
+            std::vector<struct evbuffer_iovec> extents(extent_count);
+            evbuffer_peek(output, -1, nullptr, extents.data(), extent_count);
+            size_t copied = 0;
+            for (auto &extent : extents) {
+                const uint8_t *base = static_cast<const uint8_t *>(extent.iov_base);
+                if (base < payload.data() or base >= payload.data() + payload.size()) {
+                    copied += extent.iov_len;
+                }
+            }
+            ASSERT_EQ(copied, referenced ? header_size : header_size + payload_size);
+
+            size_t length = evbuffer_get_length(output);
+            PublishPacket publish_packet2(PacketDataView(evbuffer_pullup(output, length), length));
+            ASSERT_EQ(publish_packet2.qos(), QoSType::QoS1);
+            ASSERT_EQ(publish_packet2.packet_id, 7);
+            ASSERT_EQ(publish_packet2.message_data(), message->payload);
+
+            // The bufferevent freezes the start of its output buffer, only writes to the socket may drain it
+            evbuffer_unfreeze(output, 1);
+            evbuffer_drain(output, length);
+            evbuffer_freeze(output, 1);
+            ASSERT_EQ(message.use_count(), 2);
+        }
+    }
+
+    event_base_free(evbase);
+}
+
+TEST(packets, send_failure_fails_connection) {
+
+    struct event_base *evbase = event_base_new();
+
+    for (size_t payload_size : {16, 4096}) {
+
+        PacketManager packet_manager(bufferevent_socket_new(evbase, -1, 0));
+        std::vector<PacketManager::EventType> events;
+        packet_manager.set_event_handler([&events](PacketManager::EventType event) { events.push_back(event); });
+
+        // An output buffer frozen at its end takes nothing, the send is dropped instead of throwing
+        struct evbuffer *output = bufferevent_get_output(packet_manager.bev);
+        evbuffer_freeze(output, 0);
+
+        PublishPacket publish_packet;
+        publish_packet.message = std::make_shared<Message>("a/b", std::vector<uint8_t>(payload_size, 'x'));
+        packet_manager.send_packet(publish_packet);
+        ASSERT_TRUE(events.empty());
+
+        // The failure is reported from the event loop and nothing more is sent
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+        ASSERT_EQ(events, std::vector<PacketManager::EventType>{PacketManager::EventType::NetworkError});
+
+        evbuffer_unfreeze(output, 0);
+        testing::internal::CaptureStdout();
+        packet_manager.send_packet(publish_packet);
+        ASSERT_EQ(testing::internal::GetCapturedStdout(), "");
+        packet_manager.send_packet(PingreqPacket());
+        ASSERT_EQ(evbuffer_get_length(output), static_cast<size_t>(0));
+        ASSERT_EQ(publish_packet.message.use_count(), 1);
+    }
+
+    event_base_free(evbase);
+}
+
+/**
+ * Packet handler recording the types of the packets it receives.
+ */
+class RecordingHandler : public PacketHandler {
+public:
+    std::vector<PacketType> handled;
+    size_t dispatched = 0;
+    std::vector<size_t> batches;
+    uint16_t last_packet_id = 0;
+
+    void handle_connect(const ConnectPacket &) override { handled.push_back(PacketType::Connect); }
+    void handle_connack(const ConnackPacket &) override { handled.push_back(PacketType::Connack); }
+    void handle_publish(const PublishPacket &) override { handled.push_back(PacketType::Publish); }
+    void handle_puback(const PubackPacket &packet) override {
+        handled.push_back(PacketType::Puback);
+        last_packet_id = packet.packet_id;
+    }
+    void handle_pubrec(const PubrecPacket &) override { handled.push_back(PacketType::Pubrec); }
+    void handle_pubrel(const PubrelPacket &) override { handled.push_back(PacketType::Pubrel); }
+    void handle_pubcomp(const PubcompPacket &) override { handled.push_back(PacketType::Pubcomp); }
+    void handle_subscribe(const SubscribePacket &) override { handled.push_back(PacketType::Subscribe); }
+    void handle_suback(const SubackPacket &) override { handled.push_back(PacketType::Suback); }
+    void handle_unsubscribe(const UnsubscribePacket &) override { handled.push_back(PacketType::Unsubscribe); }
+    void handle_unsuback(const UnsubackPacket &) override { handled.push_back(PacketType::Unsuback); }
+    void handle_pingreq(const PingreqPacket &) override { handled.push_back(PacketType::Pingreq); }
+    void handle_pingresp(const PingrespPacket &) override { handled.push_back(PacketType::Pingresp); }
+    void handle_disconnect(const DisconnectPacket &) override { handled.push_back(PacketType::Disconnect); }
+    void packet_dispatched() override { dispatched++; }
+    void batch_dispatched(size_t packet_count) override { batches.push_back(packet_count); }
+};
+
+TEST(packets, tag_dispatch) {
+
+    PubackPacket puback_packet;
+    puback_packet.packet_id = 42;
+
+    SubackPacket suback_packet;
+    suback_packet.packet_id = 1;
+    suback_packet.return_codes = {SubackPacket::ReturnCode::SuccessQoS0};
+
+    std::vector<std::unique_ptr<Packet>> packets;
+    packets.emplace_back(new ConnackPacket());
+    packets.emplace_back(new PubackPacket(puback_packet));
+    packets.emplace_back(new SubackPacket(suback_packet));
+    packets.emplace_back(new PingrespPacket());
+    static_cast<ConnackPacket &>(*packets[0]).return_code = ConnackPacket::ReturnCode::Accepted;
+
+    RecordingHandler handler;
+    PacketArena arena;
+
+    for (auto &packet : packets) {
+        const Packet *decoded;
+        ASSERT_EQ(decode_packet(packet->serialize(), arena, decoded), DecodeStatus::Ok);
+        ASSERT_EQ(decoded->type, packet->type);
+        dispatch_packet(*decoded, handler);
+
+        // Packets decoded by other means dispatch the same way
+        dispatch_packet(*packet, handler);
+    }
+
+    ASSERT_EQ(handler.handled, std::vector<PacketType>({PacketType::Connack, PacketType::Connack, PacketType::Puback,
+                                                        PacketType::Puback, PacketType::Suback, PacketType::Suback,
+                                                        PacketType::Pingresp, PacketType::Pingresp}));
+    ASSERT_EQ(handler.last_packet_id, 42);
+
+    // Reserved packet types and malformed packets are not decoded
+    const Packet *decoded;
+    std::vector<uint8_t> reserved = {0xF0, 0x00};
+    ASSERT_EQ(decode_packet(reserved, arena, decoded), DecodeStatus::BadType);
+    ASSERT_EQ(decoded, nullptr);
+
+    std::vector<uint8_t> bad_flags = {0x41, 0x02, 0x00, 0x01};
+    ASSERT_EQ(decode_packet(bad_flags, arena, decoded), DecodeStatus::BadFlags);
+    ASSERT_EQ(decoded, nullptr);
+}
+
+TEST(packets, packet_manager_dispatch) {
+
+    struct event_base *evbase = event_base_new();
+    struct bufferevent *pair[2];
+    bufferevent_pair_new(evbase, 0, pair);
+
+    RecordingHandler handler;
+    std::vector<PacketManager::EventType> events;
+
+    {
+        PacketManager packet_manager(pair[0]);
+        packet_manager.set_packet_handler(&handler);
+        packet_manager.set_event_handler([&events](PacketManager::EventType event) { events.push_back(event); });
+
+        PubackPacket puback_packet;
+        puback_packet.packet_id = 7;
+
+        std::vector<uint8_t> data = puback_packet.serialize();
+        std::vector<uint8_t> pingreq = PingreqPacket().serialize();
+        data.insert(data.end(), pingreq.begin(), pingreq.end());
+
+        // A malformed packet is reported and skipped
+        std::vector<uint8_t> bad_flags = {0x41, 0x02, 0x00, 0x01};
+        data.insert(data.end(), bad_flags.begin(), bad_flags.end());
+        data.insert(data.end(), pingreq.begin(), pingreq.end());
+
+        bufferevent_write(pair[1], data.data(), data.size());
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+    }
+
+    ASSERT_EQ(handler.handled, std::vector<PacketType>({PacketType::Puback, PacketType::Pingreq, PacketType::Pingreq}));
+    ASSERT_EQ(handler.dispatched, static_cast<size_t>(3));
+    ASSERT_EQ(handler.last_packet_id, 7);
+    ASSERT_EQ(events, std::vector<PacketManager::EventType>({PacketManager::EventType::ProtocolError}));
+
+    // The packets before the malformed packet form one batch, and the packet after it another
+    ASSERT_EQ(handler.batches, std::vector<size_t>({2, 1}));
+
+    bufferevent_free(pair[1]);
+    event_base_free(evbase);
+}
+
+TEST(packets, batch_dispatch) {
+
+    struct event_base *evbase = event_base_new();
+    struct bufferevent *pair[2];
+    bufferevent_pair_new(evbase, 0, pair);
+
+    RecordingHandler handler;
+
+    {
+        PacketManager packet_manager(pair[0]);
+        packet_manager.set_packet_handler(&handler);
+
+        // Pipelined publishes arriving in one read are dispatched as one batch
+        PublishPacket publish_packet;
+        publish_packet.message = std::make_shared<Message>("a/b", std::vector<uint8_t>(10, 'x'));
+        std::vector<uint8_t> publish_data = publish_packet.serialize();
+
+        std::vector<uint8_t> data;
+        for (int i = 0; i < 100; i++) {
+            data.insert(data.end(), publish_data.begin(), publish_data.end());
+        }
+
+        // The last packet is incomplete and waits for the next read
+        bufferevent_write(pair[1], data.data(), data.size() - 1);
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+        ASSERT_EQ(handler.dispatched, static_cast<size_t>(99));
+        ASSERT_EQ(handler.batches, std::vector<size_t>({99}));
+
+        bufferevent_write(pair[1], &data.back(), 1);
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+        ASSERT_EQ(handler.dispatched, static_cast<size_t>(100));
+        ASSERT_EQ(handler.batches, std::vector<size_t>({99, 1}));
+        ASSERT_EQ(packet_manager.packets_received(), static_cast<uint64_t>(100));
+        ASSERT_EQ(packet_manager.batches_received(), static_cast<uint64_t>(2));
+    }
+
+    bufferevent_free(pair[1]);
+    event_base_free(evbase);
+}
+
+TEST(packets, max_packet_size) {
+
+    struct event_base *evbase = event_base_new();
+    struct bufferevent *pair[2];
+    bufferevent_pair_new(evbase, 0, pair);
+
+    RecordingHandler handler;
+    std::vector<PacketManager::EventType> events;
+
+    {
+        PacketManager packet_manager(pair[0]);
+        packet_manager.set_packet_handler(&handler);
+        packet_manager.set_event_handler([&events](PacketManager::EventType event) { events.push_back(event); });
+        packet_manager.set_max_packet_size(64);
+
+        PublishPacket large;
+        large.message = std::make_shared<Message>("a/b", std::vector<uint8_t>(1000, 'x'));
+        std::vector<uint8_t> data = large.serialize();
+
+        PubackPacket puback_packet;
+        puback_packet.packet_id = 3;
+        std::vector<uint8_t> puback_data = puback_packet.serialize();
+        data.insert(data.end(), puback_data.begin(), puback_data.end());
+
+        // The oversized packet is rejected at its fixed header and drained as it arrives, never buffered whole
+        struct evbuffer *input = bufferevent_get_input(pair[0]);
+        for (size_t offset = 0; offset < data.size(); offset += 50) {
+            bufferevent_write(pair[1], &data[offset], std::min<size_t>(50, data.size() - offset));
+            event_base_loop(evbase, EVLOOP_NONBLOCK);
+            ASSERT_LE(evbuffer_get_length(input), static_cast<size_t>(64));
+        }
+
+        ASSERT_EQ(events, std::vector<PacketManager::EventType>({PacketManager::EventType::PacketTooLarge}));
+        ASSERT_EQ(handler.handled, std::vector<PacketType>({PacketType::Puback}));
+        ASSERT_EQ(handler.last_packet_id, 3);
+
+        // A packet of exactly the maximum size is accepted
+        PublishPacket limit;
+        limit.message = std::make_shared<Message>("a/b", std::vector<uint8_t>(64 - 7, 'x'));
+        std::vector<uint8_t> limit_data = limit.serialize();
+        ASSERT_EQ(limit_data.size(), static_cast<size_t>(64));
+        bufferevent_write(pair[1], limit_data.data(), limit_data.size());
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+        ASSERT_EQ(handler.handled, std::vector<PacketType>({PacketType::Puback, PacketType::Publish}));
+        ASSERT_EQ(events.size(), static_cast<size_t>(1));
+    }
+
+    bufferevent_free(pair[1]);
+    event_base_free(evbase);
+}
+
+TEST(packets, packet_arena) {
+
+    PacketArena arena;
+    size_t destroyed = 0;
+
+    struct Counted {
+        size_t &destroyed;
+        Counted(size_t &destroyed) : destroyed(destroyed) {}
+        ~Counted() { destroyed++; }
+    };
+
+    // Decoded packets and other objects share the arena until it is reset
+    PubackPacket puback_packet;
+    puback_packet.packet_id = 9;
+    std::vector<uint8_t> puback_data = puback_packet.serialize();
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 400; i++) {
+            const Packet *packet;
+            ASSERT_EQ(decode_packet(puback_data, arena, packet), DecodeStatus::Ok);
+            ASSERT_NE(packet, nullptr);
+            ASSERT_EQ(static_cast<const PubackPacket *>(packet)->packet_id, 9);
+            arena.create<Counted>(destroyed);
+        }
+        const Packet *packet;
+        ASSERT_EQ(decode_packet(std::vector<uint8_t>({0x41, 0x02, 0x00, 0x01}), arena, packet), DecodeStatus::BadFlags);
+        ASSERT_EQ(packet, nullptr);
+
+        arena.create<std::vector<uint8_t>>(2 * PacketArena::BlockSize);
+        arena.allocate(2 * PacketArena::BlockSize, 1);
+
+        arena.reset();
+        ASSERT_EQ(destroyed, static_cast<size_t>(400 * (round + 1)));
+        ASSERT_EQ(arena.bytes_used(), static_cast<size_t>(0));
+    }
+
+    // Blocks are kept across resets
+    size_t blocks = arena.block_count();
+    ASSERT_GT(blocks, static_cast<size_t>(1));
+    for (int i = 0; i < 400; i++) {
+        const Packet *packet;
+        decode_packet(puback_data, arena, packet);
+        arena.create<Counted>(destroyed);
+    }
+    ASSERT_EQ(arena.block_count(), blocks);
+}
+
+TEST(packets, handler_destroys_packet_manager) {
+
+    struct event_base *evbase = event_base_new();
+    struct bufferevent *pair[2];
+    bufferevent_pair_new(evbase, 0, pair);
+
+    // The first packet destroys the PacketManager, the rest are never dispatched.  Destroying the PacketManager
+    // destroys this callback so it must not touch its captures afterwards.
+    PacketManager *packet_manager = new PacketManager(pair[0]);
+    size_t received = 0;
+    packet_manager->set_packet_received_handler([&packet_manager, &received](const Packet &) {
+        received++;
+        PacketManager *destroyed = packet_manager;
+        packet_manager = nullptr;
+        delete destroyed;
+    });
+
+    std::vector<uint8_t> data;
+    for (int i = 0; i < 3; i++) {
+        std::vector<uint8_t> pingreq = PingreqPacket().serialize();
+        data.insert(data.end(), pingreq.begin(), pingreq.end());
+    }
+    bufferevent_write(pair[1], data.data(), data.size());
+    event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+    ASSERT_EQ(packet_manager, nullptr);
+    ASSERT_EQ(received, static_cast<size_t>(1));
+
+    bufferevent_free(pair[1]);
+    event_base_free(evbase);
+}
+
+TEST(packets, decode_status) {
+
+    struct Case {
+        std::vector<uint8_t> packet_data;
+        DecodeStatus status;
+    };
+
+    std::vector<Case> cases = {
+            // Remaining length continued past 4 bytes, or past the end of the packet
+            {{0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01}, DecodeStatus::MalformedLength},
+            {{0x30, 0x80}, DecodeStatus::MalformedLength},
+            {{0x40, 0x03, 0x00, 0x01}, DecodeStatus::LengthMismatch},
+            {{0x00, 0x00}, DecodeStatus::BadType},
+            {{0xF0, 0x00}, DecodeStatus::BadType},
+            {{0xC1, 0x00}, DecodeStatus::BadFlags},
+            {{0x80, 0x05, 0x00, 0x01, 0x00, 0x01, 'a'}, DecodeStatus::BadFlags},
+            {{0x40, 0x01, 0x00}, DecodeStatus::Truncated},
+            {{0x30, 0x04, 0x00, 0x05, 'a', 'b'}, DecodeStatus::TruncatedString},
+            {{0x32, 0x04, 0x00, 0x01, 'a', 0x00}, DecodeStatus::Truncated},
+            {{0x82, 0x05, 0x00, 0x01, 0x00, 0x01, 'a'}, DecodeStatus::Truncated},
+            {{0x82, 0x06, 0x00, 0x01, 0x00, 0x01, '#', 0x00}, DecodeStatus::Ok},
+            {{0x82, 0x08, 0x00, 0x01, 0x00, 0x03, '#', '/', 'a', 0x00}, DecodeStatus::InvalidTopic},
+            {{0xA2, 0x05, 0x00, 0x01, 0x00, 0x01, '+'}, DecodeStatus::Ok},
+            {{0xA2, 0x06, 0x00, 0x01, 0x00, 0x02, 'a', '+'}, DecodeStatus::InvalidTopic},
+            {{0x30, 0x06, 0x00, 0x03, 'a', '/', 'b', 'x'}, DecodeStatus::Ok},
+            {{0x30, 0x05, 0x00, 0x03, 'a', '/', '+'}, DecodeStatus::InvalidTopic},
+            {{0x32, 0x07, 0x00, 0x03, 'a', '/', '#', 0x00, 0x01}, DecodeStatus::InvalidTopic},
+            {{0x30, 0x05, 0x00, 0x03, 'a', '/', 0xFF}, DecodeStatus::InvalidTopic},
+            {{0x30, 0x04, 0x00, 0x02, 'a', 0x00}, DecodeStatus::InvalidTopic},
+    };
+
+    PacketArena arena;
+
+    for (auto &c : cases) {
+        const Packet *packet;
+        ASSERT_EQ(decode_packet(c.packet_data, arena, packet), c.status) << decode_status_name(c.status);
+        ASSERT_EQ(packet != nullptr, c.status == DecodeStatus::Ok);
+    }
+
+    // The throwing constructors wrap decode
+    ASSERT_THROW(SubscribePacket(cases[12].packet_data), std::exception);
+    ASSERT_NO_THROW(SubscribePacket(cases[11].packet_data));
+    ASSERT_THROW(PublishPacket(cases[18].packet_data), std::exception);
+    ASSERT_NO_THROW(PublishPacket(cases[15].packet_data));
+
+    // Publish headers decoded for streaming are checked the same way
+    PublishPacket header;
+    size_t payload_length;
+    ASSERT_EQ(header.decode_header(cases[15].packet_data, payload_length), DecodeStatus::Ok);
+    ASSERT_EQ(payload_length, static_cast<size_t>(1));
+    ASSERT_EQ(header.decode_header(cases[16].packet_data, payload_length), DecodeStatus::InvalidTopic);
+
+    PacketDataReader reader(cases[8].packet_data);
+    uint8_t byte;
+    std::string s;
+    ASSERT_TRUE(reader.read_byte(byte));
+    ASSERT_TRUE(reader.read_byte(byte));
+    ASSERT_FALSE(reader.read_string(s));
+    ASSERT_EQ(reader.get_status(), DecodeStatus::TruncatedString);
+    ASSERT_EQ(reader.get_offset(), static_cast<size_t>(2));
+}
@@ -49,6 +49,10 @@ public:
 
     void TearDown() {
 
+        // bufferevents must be released before the event base
+        packet_manager.reset();
+        session_manager.sessions.clear();
+
         evconnlistener_free(listener);
         event_base_free(evloop);
 
@@ -106,7 +110,7 @@ public:
 
     virtual void connection_made() = 0;
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) = 0;
+    virtual void packet_received_callback(const Packet &packet) = 0;
 
 };
 
@@ -119,10 +123,10 @@ class Connect : public Protocol {
 
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Connack);
-        ConnackPacket &connack_packet = dynamic_cast<ConnackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Connack);
+        const ConnackPacket &connack_packet = dynamic_cast<const ConnackPacket &>(packet);
         ASSERT_EQ(connack_packet.return_code, ConnackPacket::ReturnCode::Accepted);
 
         DisconnectPacket disconnect_packet;
@@ -141,9 +145,9 @@ class Ping : public Protocol {
         packet_manager->send_packet(pingreq_packet);
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Pingresp);
+        ASSERT_EQ(packet.type, PacketType::Pingresp);
 
         DisconnectPacket disconnect_packet;
         packet_manager->send_packet(disconnect_packet);
@@ -178,10 +182,10 @@ class Subscribe : public Protocol {
 
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Connack);
-        ConnackPacket &connack_packet = dynamic_cast<ConnackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Connack);
+        const ConnackPacket &connack_packet = dynamic_cast<const ConnackPacket &>(packet);
         ASSERT_EQ(connack_packet.return_code, ConnackPacket::ReturnCode::Accepted);
 
         this->packet_manager->set_packet_received_handler(
@@ -189,10 +193,10 @@ class Subscribe : public Protocol {
 
     }
 
-    void suback_received_callback(std::unique_ptr<Packet> packet) {
+    void suback_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Suback);
-        SubackPacket &suback_packet = dynamic_cast<SubackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Suback);
+        const SubackPacket &suback_packet = dynamic_cast<const SubackPacket &>(packet);
         ASSERT_EQ(suback_packet.packet_id, subscribe_packet_id);
 
         ASSERT_EQ(suback_packet.return_codes.size(), static_cast<size_t>(3));
@@ -234,10 +238,10 @@ class Unsubscribe : public Protocol {
         packet_manager->send_packet(unsubscribe_packet);
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Connack);
-        ConnackPacket &connack_packet = dynamic_cast<ConnackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Connack);
+        const ConnackPacket &connack_packet = dynamic_cast<const ConnackPacket &>(packet);
         ASSERT_EQ(connack_packet.return_code, ConnackPacket::ReturnCode::Accepted);
 
         this->packet_manager->set_packet_received_handler(
@@ -245,10 +249,10 @@ class Unsubscribe : public Protocol {
 
     }
 
-    void unsuback_received_callback(std::unique_ptr<Packet> packet) {
+    void unsuback_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Unsuback);
-        UnsubackPacket &unsuback_packet = dynamic_cast<UnsubackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Unsuback);
+        const UnsubackPacket &unsuback_packet = dynamic_cast<const UnsubackPacket &>(packet);
         ASSERT_EQ(unsuback_packet.packet_id, unsubscribe_packet_id);
 
         DisconnectPacket disconnect_packet;
@@ -271,17 +275,17 @@ class PublishQoS0 : public Protocol {
         packet_manager->send_packet(connect_packet);
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Connack);
-        ConnackPacket &connack_packet = dynamic_cast<ConnackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Connack);
+        const ConnackPacket &connack_packet = dynamic_cast<const ConnackPacket &>(packet);
         ASSERT_EQ(connack_packet.return_code, ConnackPacket::ReturnCode::Accepted);
 
         PublishPacket publish_packet;
         publish_packet.packet_id = this->packet_manager->next_packet_id();
 
-        publish_packet.topic_name = topic;
-        publish_packet.message_data = std::vector<uint8_t>(message_data.begin(), message_data.end());
+        publish_packet.message = std::make_shared<Message>(
+                topic, std::vector<uint8_t>(message_data.begin(), message_data.end()));
         publish_packet.qos(qos);
         packet_manager->send_packet(publish_packet);
 
@@ -306,18 +310,18 @@ class PublishQoS1 : public Protocol {
 
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Connack);
-        ConnackPacket &connack_packet = dynamic_cast<ConnackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Connack);
+        const ConnackPacket &connack_packet = dynamic_cast<const ConnackPacket &>(packet);
         ASSERT_EQ(connack_packet.return_code, ConnackPacket::ReturnCode::Accepted);
 
         PublishPacket publish_packet;
         publish_packet.packet_id = this->packet_manager->next_packet_id();
         publish_packet_id = publish_packet.packet_id;
 
-        publish_packet.topic_name = topic;
-        publish_packet.message_data = std::vector<uint8_t>(message_data.begin(), message_data.end());
+        publish_packet.message = std::make_shared<Message>(
+                topic, std::vector<uint8_t>(message_data.begin(), message_data.end()));
         publish_packet.qos(qos);
         packet_manager->send_packet(publish_packet);
 
@@ -326,10 +330,10 @@ class PublishQoS1 : public Protocol {
 
     }
 
-    void puback_received_callback(std::unique_ptr<Packet> packet) {
+    void puback_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Puback);
-        PubackPacket &puback_packet = dynamic_cast<PubackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Puback);
+        const PubackPacket &puback_packet = dynamic_cast<const PubackPacket &>(packet);
         ASSERT_EQ(puback_packet.packet_id, publish_packet_id);
 
         DisconnectPacket disconnect_packet;
@@ -354,18 +358,18 @@ class PublishQoS2 : public Protocol {
 
     }
 
-    virtual void packet_received_callback(std::unique_ptr<Packet> packet) {
+    virtual void packet_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Connack);
-        ConnackPacket &connack_packet = dynamic_cast<ConnackPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Connack);
+        const ConnackPacket &connack_packet = dynamic_cast<const ConnackPacket &>(packet);
         ASSERT_EQ(connack_packet.return_code, ConnackPacket::ReturnCode::Accepted);
 
         PublishPacket publish_packet;
         publish_packet.packet_id = this->packet_manager->next_packet_id();
         publish_packet_id = publish_packet.packet_id;
 
-        publish_packet.topic_name = topic;
-        publish_packet.message_data = std::vector<uint8_t>(message_data.begin(), message_data.end());
+        publish_packet.message = std::make_shared<Message>(
+                topic, std::vector<uint8_t>(message_data.begin(), message_data.end()));
         publish_packet.qos(qos);
         packet_manager->send_packet(publish_packet);
 
@@ -374,10 +378,10 @@ class PublishQoS2 : public Protocol {
 
     }
 
-    void pubrec_received_callback(std::unique_ptr<Packet> packet) {
+    void pubrec_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Pubrec);
-        PubrecPacket &pubrec_packet = dynamic_cast<PubrecPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Pubrec);
+        const PubrecPacket &pubrec_packet = dynamic_cast<const PubrecPacket &>(packet);
         ASSERT_EQ(pubrec_packet.packet_id, publish_packet_id);
 
         PubrelPacket pubrel_packet;
@@ -389,10 +393,10 @@ class PublishQoS2 : public Protocol {
 
     }
 
-    void pubcomp_received_callback(std::unique_ptr<Packet> packet) {
+    void pubcomp_received_callback(const Packet &packet) {
 
-        ASSERT_EQ(packet->type, PacketType::Pubcomp);
-        PubcompPacket &pubcomp_packet = dynamic_cast<PubcompPacket &>(*packet);
+        ASSERT_EQ(packet.type, PacketType::Pubcomp);
+        const PubcompPacket &pubcomp_packet = dynamic_cast<const PubcompPacket &>(packet);
         ASSERT_EQ(pubcomp_packet.packet_id, publish_packet_id);
 
         DisconnectPacket disconnect_packet;
@@ -11,8 +11,10 @@
 
 #include <event2/listener.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/dns.h>
 
+#include <algorithm>
 #include <cstring>
 
 class SessionProtocol : public testing::Test {
@@ -51,6 +53,9 @@ public:
 
     void TearDown() {
 
+        // bufferevents must be released before the event base
+        session_manager.sessions.clear();
+
         evconnlistener_free(listener);
         event_base_free(evloop);
     }
@@ -159,24 +164,35 @@ struct TestParams {
     std::string test_topic;
     std::string test_message;
     QoSType qos;
+    QoSType subscribe_qos;
 };
 
 static TestParams qos0_params = {
         .test_topic = "a/b/c",
         .test_message = "test message",
         .qos = QoSType::QoS0,
+        .subscribe_qos = QoSType::QoS0,
 };
 
 static TestParams qos1_params = {
         .test_topic = "a/b/c",
         .test_message = "test message",
         .qos = QoSType::QoS1,
+        .subscribe_qos = QoSType::QoS1,
 };
 
 static TestParams qos2_params = {
         .test_topic = "a/b/c",
         .test_message = "test message",
         .qos = QoSType::QoS2,
+        .subscribe_qos = QoSType::QoS2,
+};
+
+static TestParams downgrade_params = {
+        .test_topic = "a/b/c",
+        .test_message = "test message",
+        .qos = QoSType::QoS2,
+        .subscribe_qos = QoSType::QoS0,
 };
 
 template<typename ::TestParams *params>
@@ -227,6 +243,20 @@ TEST_F(SessionProtocol, qos2_test) {
 
 }
 
+TEST_F(SessionProtocol, qos_downgrade_test) {
+
+    Client<PublisherSession<&downgrade_params>> publisher(evloop);
+
+    Client<SubscriberSession<&downgrade_params>> subscriber(evloop);
+
+    subscriber.on_ready = [&publisher]() { publisher.connect_to_broker(); };
+
+    subscriber.connect_to_broker();
+
+    event_base_dispatch(evloop);
+
+}
+
 template<typename ::TestParams *params>
 class SubscriberSession : public TestSession {
 
@@ -237,7 +267,7 @@ public:
     void handle_connack(const ConnackPacket &connack_packet) override {
         SubscribePacket subscribe_packet;
         subscribe_packet.packet_id = packet_manager->next_packet_id();
-        subscribe_packet.subscriptions.push_back(Subscription{params->test_topic, params->qos});
+        subscribe_packet.subscriptions.push_back(Subscription{params->test_topic, params->subscribe_qos});
         packet_manager->send_packet(subscribe_packet);
     }
 
@@ -247,8 +277,9 @@ public:
 
     void handle_publish(const PublishPacket &publish_packet) override {
 
-        ASSERT_EQ(publish_packet.message_data,
+        ASSERT_EQ(publish_packet.message_data(),
                   std::vector<uint8_t>(params->test_message.begin(), params->test_message.end()));
+        ASSERT_EQ(publish_packet.qos(), std::min(params->qos, params->subscribe_qos));
 
         if (publish_packet.qos() == QoSType::QoS0) {
             disconnect_all();
@@ -267,7 +298,7 @@ public:
     }
 
     void handle_pubrel(const PubrelPacket &pubrel_packet) override {
-        ASSERT_EQ(params->qos, QoSType::QoS2);
+        ASSERT_EQ(params->subscribe_qos, QoSType::QoS2);
 
         PubcompPacket pubcomp_packet;
         pubcomp_packet.packet_id = pubrel_packet.packet_id;
@@ -287,10 +318,9 @@ public:
 
         PublishPacket publish_packet;
         publish_packet.qos(params->qos);
-        publish_packet.topic_name = params->test_topic;
+        publish_packet.message = std::make_shared<Message>(
+                params->test_topic, std::vector<uint8_t>(params->test_message.begin(), params->test_message.end()));
         publish_packet.packet_id = packet_manager->next_packet_id();
-        publish_packet.message_data = std::vector<uint8_t>(params->test_message.begin(),
-                                                           params->test_message.end());
         packet_manager->send_packet(publish_packet);
 
         if (params->qos == QoSType::QoS0) {
@@ -322,3 +352,503 @@ public:
     }
 
 };
+
+TEST(session_manager, fan_out_shares_message) {
+
+    struct event_base *evloop = event_base_new();
+    ASSERT_NE(evloop, nullptr);
+
+    {
+        SessionManager session_manager;
+        std::vector<std::unique_ptr<BrokerSession>> sessions;
+        for (int i = 0; i < 8; i++) {
+            sessions.emplace_back(new BrokerSession(bufferevent_socket_new(evloop, -1, 0), session_manager));
+            QoSType qos = static_cast<QoSType>(i % 3);
+            session_manager.subscribe(sessions.back().get(), Subscription{TopicFilter("fan/out"), qos});
+        }
+
+        PublishPacket packet;
+        packet.qos(QoSType::QoS2);
+        packet.packet_id = 1;
+        packet.message = std::make_shared<Message>("fan/out", std::vector<uint8_t>(1024, 'x'));
+
+        session_manager.handle_publish(packet);
+
+        // Every pending delivery refers to the published message rather than a copy of it
+        size_t pending = 0;
+        for (auto &session : sessions) {
+            for (auto &pending_packet : session->qos1_pending_puback) {
+                ASSERT_EQ(pending_packet.message, packet.message);
+                ASSERT_EQ(pending_packet.qos(), QoSType::QoS1);
+                pending++;
+            }
+            for (auto &pending_packet : session->qos2_pending_pubrec) {
+                ASSERT_EQ(pending_packet.message, packet.message);
+                ASSERT_EQ(pending_packet.qos(), QoSType::QoS2);
+                pending++;
+            }
+        }
+        ASSERT_EQ(pending, static_cast<size_t>(5));
+        // Each output buffer also refers to the payload until it is written
+        ASSERT_EQ(packet.message.use_count(), static_cast<long>(6 + sessions.size()));
+    }
+
+    event_base_free(evloop);
+}
+
+TEST(session_manager, max_packet_size) {
+
+    struct event_base *evloop = event_base_new();
+    ASSERT_NE(evloop, nullptr);
+
+    {
+        SessionManager session_manager;
+        session_manager.max_packet_size = 1024;
+        session_manager.client_max_packet_sizes["camera"] = 1 << 20;
+
+        // Accepted connections get the listener limit, a client's own limit applies once it connects
+        session_manager.accept_connection(bufferevent_socket_new(evloop, -1, 0));
+        session_manager.accept_connection(bufferevent_socket_new(evloop, -1, 0));
+
+        std::vector<BrokerSession *> sessions;
+        for (auto &session : session_manager.sessions) {
+            ASSERT_EQ(session->packet_manager->get_max_packet_size(), static_cast<size_t>(1024));
+            size_t low, high;
+            bufferevent_getwatermark(session->packet_manager->bev, EV_READ, &low, &high);
+            ASSERT_EQ(high, static_cast<size_t>(1024));
+            sessions.push_back(session.get());
+        }
+
+        ConnectPacket connect_packet;
+        connect_packet.clean_session(true);
+        connect_packet.client_id = "camera";
+        sessions[0]->handle_connect(connect_packet);
+        connect_packet.client_id = "sensor";
+        sessions[1]->handle_connect(connect_packet);
+
+        ASSERT_EQ(sessions[0]->packet_manager->get_max_packet_size(), static_cast<size_t>(1 << 20));
+        ASSERT_EQ(sessions[1]->packet_manager->get_max_packet_size(), static_cast<size_t>(1024));
+
+        session_manager.sessions.clear();
+    }
+
+    event_base_free(evloop);
+}
+
+TEST(session_manager, invalid_topic_not_routed) {
+
+    struct event_base *evloop = event_base_new();
+    ASSERT_NE(evloop, nullptr);
+
+    {
+        SessionManager session_manager;
+        BrokerSession subscriber(bufferevent_socket_new(evloop, -1, 0), session_manager);
+        session_manager.subscribe(&subscriber, Subscription{TopicFilter("#"), QoSType::QoS0});
+
+        // Names that are not valid topic names are dropped rather than thrown on
+        for (std::string topic_name : {"a/+", "a/#", "a/\xff"}) {
+            PublishPacket packet;
+            packet.message = std::make_shared<Message>(topic_name, std::vector<uint8_t>(8, 'x'));
+            session_manager.handle_publish(packet);
+        }
+        ASSERT_EQ(session_manager.dropped(), static_cast<uint64_t>(3));
+
+        PublishPacket packet;
+        packet.message = std::make_shared<Message>("a/b", std::vector<uint8_t>(8, 'x'));
+        session_manager.handle_publish(packet);
+        ASSERT_EQ(session_manager.dropped(), static_cast<uint64_t>(3));
+        ASSERT_NE(evbuffer_get_length(bufferevent_get_output(subscriber.packet_manager->bev)), static_cast<size_t>(0));
+    }
+
+    event_base_free(evloop);
+}
+
+/**
+ * Copy the contents of a session's output buffer, peeking since the bufferevent freezes its start.
+ */
+static std::vector<uint8_t> output_data(BrokerSession &session) {
+
+    struct evbuffer *output = bufferevent_get_output(session.packet_manager->bev);
+
+    int extent_count = evbuffer_peek(output, -1, nullptr, nullptr, 0);
+    std::vector<struct evbuffer_iovec> extents(extent_count);
+    evbuffer_peek(output, -1, nullptr, extents.data(), extent_count);
+
+    std::vector<uint8_t> data;
+    for (auto &extent : extents) {
+        const uint8_t *base = static_cast<const uint8_t *>(extent.iov_base);
+        data.insert(data.end(), base, base + extent.iov_len);
+    }
+    return data;
+}
+
+/**
+ * Publishes above the stream threshold sent from the client end of a bufferevent pair.  Subscriber connections have no
+ * socket, their output stays in the buffer to be read by the test.
+ */
+class StreamedPublish : public testing::Test {
+public:
+
+    struct event_base *evloop;
+
+    SessionManager session_manager;
+
+    std::vector<struct bufferevent *> clients;
+
+    void SetUp() {
+        evloop = event_base_new();
+        ASSERT_NE(evloop, nullptr);
+        session_manager.stream_threshold = 4096;
+    }
+
+    void TearDown() {
+
+        // bufferevents must be released before the event base
+        session_manager.sessions.clear();
+        for (auto bev : clients) {
+            bufferevent_free(bev);
+        }
+
+        event_base_free(evloop);
+    }
+
+    /** Accept a publisher connection, client is set to the end the test writes to. */
+    BrokerSession &connect_publisher(struct bufferevent *&client) {
+
+        struct bufferevent *pair[2];
+        bufferevent_pair_new(evloop, 0, pair);
+        bufferevent_enable(pair[1], EV_READ);
+        clients.push_back(pair[1]);
+        client = pair[1];
+
+        session_manager.accept_connection(pair[0]);
+        return *session_manager.sessions.back();
+    }
+
+    /** Subscribe a session to a filter as BrokerSession::handle_subscribe does, without sending a Suback. */
+    void subscribe(BrokerSession &session, const std::string &filter, QoSType qos) {
+        Subscription subscription{TopicFilter(filter), qos};
+        session.subscriptions.insert(subscription);
+        session_manager.subscribe(&session, subscription);
+    }
+
+    /** Accept a subscriber connection and subscribe it to a filter. */
+    BrokerSession &subscribe(const std::string &filter, QoSType qos) {
+
+        session_manager.accept_connection(bufferevent_socket_new(evloop, -1, 0));
+        BrokerSession &session = *session_manager.sessions.back();
+        subscribe(session, filter, qos);
+        return session;
+    }
+
+    /** Write part of a packet from a client and run the callbacks it causes. */
+    void send(struct bufferevent *client, const packet_data_t &data, size_t offset, size_t length) {
+        bufferevent_write(client, data.data() + offset, length);
+        event_base_loop(evloop, EVLOOP_NONBLOCK);
+    }
+
+    /** Take everything the broker has sent to a client. */
+    static packet_data_t received(struct bufferevent *client) {
+        struct evbuffer *input = bufferevent_get_input(client);
+        packet_data_t data(evbuffer_get_length(input));
+        evbuffer_remove(input, data.data(), data.size());
+        return data;
+    }
+
+    /** A publish with a payload of the given length. */
+    static PublishPacket publish(const std::string &topic, QoSType qos, uint16_t packet_id, size_t length) {
+
+        std::vector<uint8_t> payload(length);
+        for (size_t i = 0; i < payload.size(); i++) {
+            payload[i] = static_cast<uint8_t>(i);
+        }
+
+        PublishPacket packet;
+        packet.qos(qos);
+        packet.packet_id = packet_id;
+        packet.message = std::make_shared<Message>(topic, payload);
+        return packet;
+    }
+
+    /** The encoded QoS 0 delivery of a publish. */
+    static std::vector<uint8_t> delivery(const PublishPacket &packet) {
+        PublishPacket delivery(packet);
+        delivery.qos(QoSType::QoS0);
+        packet_data_t data = delivery.serialize();
+        return std::vector<uint8_t>(data.begin(), data.end());
+    }
+
+    /** Length of the encoded packet ahead of the payload. */
+    static size_t header_length(const packet_data_t &data, const PublishPacket &packet) {
+        return data.size() - packet.message->payload.size();
+    }
+};
+
+TEST_F(StreamedPublish, cut_through_delivery) {
+
+    struct bufferevent *client;
+    BrokerSession &publisher = connect_publisher(client);
+
+    // Two QoS 0 subscribers are streamed to, the QoS 1 subscriber is store and forward
+    BrokerSession &streamed1 = subscribe("camera/frames", QoSType::QoS0);
+    BrokerSession &streamed2 = subscribe("camera/frames", QoSType::QoS0);
+    BrokerSession &stored = subscribe("camera/frames", QoSType::QoS1);
+
+    PublishPacket packet = publish("camera/frames", QoSType::QoS1, 7, 20000);
+    packet_data_t data = packet.serialize();
+    size_t header = header_length(data, packet);
+
+    std::vector<uint8_t> expected = delivery(packet);
+    size_t delivery_header = expected.size() - packet.message->payload.size();
+
+    // Routing happens on the headers, streamed subscribers receive each part of the payload as it arrives
+    send(client, data, 0, header + 1000);
+
+    for (BrokerSession *session : {&streamed1, &streamed2}) {
+        std::vector<uint8_t> output = output_data(*session);
+        ASSERT_EQ(output.size(), delivery_header + 1000);
+        ASSERT_TRUE(std::equal(output.begin(), output.end(), expected.begin()));
+    }
+    ASSERT_TRUE(output_data(stored).empty());
+    ASSERT_TRUE(received(client).empty());
+
+    // Packets sent while the publish is streamed follow it
+    streamed1.packet_manager->send_packet(PingrespPacket());
+    ASSERT_EQ(output_data(streamed1).size(), delivery_header + 1000);
+
+    send(client, data, header + 1000, data.size() - header - 1000);
+
+    packet_data_t pingresp = PingrespPacket().serialize();
+    std::vector<uint8_t> output = output_data(streamed1);
+    ASSERT_EQ(output.size(), expected.size() + pingresp.size());
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), output.begin()));
+    ASSERT_TRUE(std::equal(pingresp.begin(), pingresp.end(), output.begin() + expected.size()));
+    ASSERT_EQ(output_data(streamed2), expected);
+
+    // The complete message is stored for the QoS 1 subscriber and the publisher acknowledged
+    ASSERT_EQ(stored.qos1_pending_puback.size(), static_cast<size_t>(1));
+    ASSERT_EQ(stored.qos1_pending_puback[0].message->payload, packet.message->payload);
+    ASSERT_EQ(received(client), (packet_data_t{0x40, 0x02, 0x00, 0x07}));
+    ASSERT_EQ(publisher.packet_manager->packets_received(), static_cast<uint64_t>(1));
+
+    // A publisher closing its connection mid-payload publishes nothing and fails the streamed connections
+    size_t stored_output = output_data(stored).size();
+    send(client, data, 0, header + 1000);
+    bufferevent_flush(client, EV_WRITE, BEV_FINISHED);
+    event_base_loop(evloop, EVLOOP_NONBLOCK);
+
+    ASSERT_EQ(publisher.packet_manager->bev, nullptr);
+    ASSERT_EQ(publisher.publish_stream, nullptr);
+    ASSERT_EQ(streamed1.packet_manager->bev, nullptr);
+    ASSERT_EQ(streamed2.packet_manager->bev, nullptr);
+    ASSERT_EQ(stored.qos1_pending_puback.size(), static_cast<size_t>(1));
+    ASSERT_EQ(output_data(stored).size(), stored_output);
+}
+
+TEST_F(StreamedPublish, declined_without_streamed_delivery) {
+
+    struct bufferevent *client;
+    BrokerSession &publisher = connect_publisher(client);
+
+    // The only QoS 0 subscriber is the publisher itself, the other delivery must be stored
+    subscribe(publisher, "camera/#", QoSType::QoS0);
+    BrokerSession &stored = subscribe("camera/frames", QoSType::QoS1);
+
+    PublishPacket packet = publish("camera/frames", QoSType::QoS1, 3, 20000);
+    packet_data_t data = packet.serialize();
+    size_t header = header_length(data, packet);
+
+    send(client, data, 0, header + 1000);
+
+    // The packet is buffered whole and published as any other
+    ASSERT_EQ(publisher.publish_stream, nullptr);
+    ASSERT_TRUE(received(client).empty());
+    ASSERT_TRUE(output_data(stored).empty());
+
+    send(client, data, header + 1000, data.size() - header - 1000);
+
+    ASSERT_EQ(stored.qos1_pending_puback.size(), static_cast<size_t>(1));
+    ASSERT_EQ(stored.qos1_pending_puback[0].message->payload, packet.message->payload);
+
+    std::vector<uint8_t> expected = delivery(packet);
+    packet_data_t output = received(client);
+    ASSERT_EQ(output.size(), expected.size() + 4);
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), output.begin()));
+    ASSERT_EQ(packet_data_t(output.end() - 4, output.end()), (packet_data_t{0x40, 0x02, 0x00, 0x03}));
+}
+
+TEST_F(StreamedPublish, qos2_duplicate_declined) {
+
+    struct bufferevent *client;
+    BrokerSession &publisher = connect_publisher(client);
+    BrokerSession &subscriber = subscribe("camera/frames", QoSType::QoS0);
+
+    PublishPacket packet = publish("camera/frames", QoSType::QoS2, 9, 20000);
+    packet_data_t data = packet.serialize();
+    size_t header = header_length(data, packet);
+
+    send(client, data, 0, data.size());
+
+    std::vector<uint8_t> expected = delivery(packet);
+    ASSERT_EQ(output_data(subscriber), expected);
+    ASSERT_EQ(received(client), (packet_data_t{0x50, 0x02, 0x00, 0x09}));
+
+    // Sent again before the Pubrel the message has already been published, it is acknowledged and not delivered
+    packet.dup(true);
+    data = packet.serialize();
+
+    send(client, data, 0, header + 1000);
+    ASSERT_EQ(publisher.publish_stream, nullptr);
+    ASSERT_EQ(output_data(subscriber), expected);
+
+    send(client, data, header + 1000, data.size() - header - 1000);
+    ASSERT_EQ(output_data(subscriber), expected);
+    ASSERT_EQ(received(client), (packet_data_t{0x50, 0x02, 0x00, 0x09}));
+}
+
+TEST_F(StreamedPublish, shared_group_store_and_forward) {
+
+    struct bufferevent *client;
+    connect_publisher(client);
+    BrokerSession &streamed = subscribe("camera/frames", QoSType::QoS0);
+    BrokerSession &member = subscribe("$share/viewers/camera/frames", QoSType::QoS0);
+
+    PublishPacket packet = publish("camera/frames", QoSType::QoS0, 0, 20000);
+    packet_data_t data = packet.serialize();
+    size_t header = header_length(data, packet);
+
+    // The group chooses its member once the message is complete
+    send(client, data, 0, header + 1000);
+    ASSERT_EQ(output_data(streamed).size(), header + 1000);
+    ASSERT_TRUE(output_data(member).empty());
+
+    send(client, data, header + 1000, data.size() - header - 1000);
+    ASSERT_EQ(output_data(streamed), delivery(packet));
+    ASSERT_EQ(output_data(member), delivery(packet));
+}
+
+TEST_F(StreamedPublish, subscriber_erased_mid_stream) {
+
+    struct bufferevent *client;
+    connect_publisher(client);
+    BrokerSession &erased = subscribe("camera/frames", QoSType::QoS0);
+    BrokerSession &streamed = subscribe("camera/frames", QoSType::QoS0);
+    BrokerSession &stored = subscribe("camera/frames", QoSType::QoS1);
+
+    PublishPacket packet = publish("camera/frames", QoSType::QoS1, 5, 20000);
+    packet_data_t data = packet.serialize();
+    size_t header = header_length(data, packet);
+
+    send(client, data, 0, header + 1000);
+    ASSERT_FALSE(output_data(erased).empty());
+
+    // A session taking the place of the erased one, possibly at its address, is not mistaken for a streamed delivery
+    session_manager.erase_session(&erased);
+    BrokerSession &replacement = subscribe("camera/frames", QoSType::QoS0);
+
+    send(client, data, header + 1000, data.size() - header - 1000);
+
+    ASSERT_EQ(output_data(streamed), delivery(packet));
+    ASSERT_EQ(output_data(replacement), delivery(packet));
+    ASSERT_EQ(stored.qos1_pending_puback.size(), static_cast<size_t>(1));
+    ASSERT_EQ(received(client), (packet_data_t{0x40, 0x02, 0x00, 0x05}));
+}
+
+TEST_F(StreamedPublish, busy_subscriber_store_and_forward) {
+
+    struct bufferevent *first_client;
+    struct bufferevent *second_client;
+    connect_publisher(first_client);
+    connect_publisher(second_client);
+    BrokerSession &busy = subscribe("camera/#", QoSType::QoS0);
+    BrokerSession &idle = subscribe("camera/b", QoSType::QoS0);
+
+    PublishPacket first = publish("camera/a", QoSType::QoS0, 0, 20000);
+    packet_data_t first_data = first.serialize();
+    size_t first_header = header_length(first_data, first);
+
+    PublishPacket second = publish("camera/b", QoSType::QoS0, 0, 10000);
+    packet_data_t second_data = second.serialize();
+
+    send(first_client, first_data, 0, first_header + 1000);
+    ASSERT_EQ(output_data(busy).size(), first_header + 1000);
+
+    // A connection receives one stream at a time, a second publish is sent once the first is complete
+    send(second_client, second_data, 0, second_data.size());
+    ASSERT_EQ(output_data(idle), delivery(second));
+    ASSERT_EQ(output_data(busy).size(), first_header + 1000);
+
+    send(first_client, first_data, first_header + 1000, first_data.size() - first_header - 1000);
+
+    std::vector<uint8_t> expected = delivery(first);
+    std::vector<uint8_t> second_delivery = delivery(second);
+    expected.insert(expected.end(), second_delivery.begin(), second_delivery.end());
+    ASSERT_EQ(output_data(busy), expected);
+}
+
+TEST_F(StreamedPublish, publisher_resumed_mid_stream) {
+
+    struct bufferevent *client;
+    BrokerSession &publisher = connect_publisher(client);
+    BrokerSession &streamed = subscribe("camera/frames", QoSType::QoS0);
+    BrokerSession &stored = subscribe("camera/frames", QoSType::QoS1);
+
+    ConnectPacket connect_packet;
+    connect_packet.client_id = "camera";
+    connect_packet.clean_session(false);
+    packet_data_t connect_data = connect_packet.serialize();
+    send(client, connect_data, 0, connect_data.size());
+    ASSERT_EQ(received(client), (packet_data_t{0x20, 0x02, 0x00, 0x00}));
+
+    PublishPacket packet = publish("camera/frames", QoSType::QoS1, 4, 20000);
+    packet_data_t data = packet.serialize();
+    size_t header = header_length(data, packet);
+
+    send(client, data, 0, header + 1000);
+    ASSERT_NE(publisher.publish_stream, nullptr);
+
+    // The client reconnects before the payload is complete, its session is resumed on the new connection
+    struct bufferevent *reconnected;
+    connect_publisher(reconnected);
+    send(reconnected, connect_data, 0, connect_data.size());
+    event_base_loop(evloop, EVLOOP_NONBLOCK);
+
+    ASSERT_EQ(received(reconnected), (packet_data_t{0x20, 0x02, 0x01, 0x00}));
+    ASSERT_EQ(publisher.publish_stream, nullptr);
+    ASSERT_EQ(streamed.packet_manager->bev, nullptr);
+    ASSERT_TRUE(stored.qos1_pending_puback.empty());
+
+    // The message sent again on the new connection is published once
+    send(reconnected, data, 0, data.size());
+    ASSERT_EQ(stored.qos1_pending_puback.size(), static_cast<size_t>(1));
+    ASSERT_EQ(stored.qos1_pending_puback[0].message->payload, packet.message->payload);
+    ASSERT_EQ(received(reconnected), (packet_data_t{0x40, 0x02, 0x00, 0x04}));
+}
+
+TEST_F(StreamedPublish, invalid_topic_fails_publisher) {
+
+    BrokerSession &subscriber = subscribe("#", QoSType::QoS0);
+
+    // Wildcards and malformed UTF-8 are not valid in a published topic name, whether or not the publish is streamed
+    for (size_t length : {16, 20000}) {
+        for (std::string topic_name : {"a/+", "a/#", "a/\xff"}) {
+            struct bufferevent *client;
+            BrokerSession &publisher = connect_publisher(client);
+
+            packet_data_t data = publish(topic_name, QoSType::QoS0, 0, length).serialize();
+            send(client, data, 0, data.size());
+
+            ASSERT_EQ(publisher.packet_manager->bev, nullptr);
+            ASSERT_EQ(publisher.publish_stream, nullptr);
+        }
+    }
+    ASSERT_TRUE(output_data(subscriber).empty());
+
+    // The broker carries on routing valid names
+    struct bufferevent *client;
+    connect_publisher(client);
+    PublishPacket packet = publish("a/b", QoSType::QoS0, 0, 16);
+    packet_data_t data = packet.serialize();
+    send(client, data, 0, data.size());
+    ASSERT_EQ(output_data(subscriber), delivery(packet));
+}
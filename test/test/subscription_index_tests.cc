@@ -0,0 +1,450 @@
+#include "gtest/gtest.h"
+
+#include "subscription_index.h"
+#include "routing_cache.h"
+#include "shared_subscription.h"
+#include "subscription_set.h"
+#include "routing_filter.h"
+#include "session_manager.h"
+#include "broker_session.h"
+
+#include <event2/bufferevent.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+
+// The index never dereferences session pointers, distinct addresses are enough to tell subscribers apart.
+static BrokerSession *const session1 = reinterpret_cast<BrokerSession *>(0x10);
+static BrokerSession *const session2 = reinterpret_cast<BrokerSession *>(0x20);
+
+static size_t count_matches(const SubscriptionIndex &index, const std::string &topic, BrokerSession *session) {
+    std::vector<Subscriber> subscribers;
+    index.match(TopicName(topic), subscribers);
+    return std::count_if(subscribers.begin(), subscribers.end(),
+                         [session](const Subscriber &s) { return s.session == session; });
+}
+
+TEST(subscription_index, matching_filter_names) {
+
+    typedef std::string filter_t;
+    typedef std::string topic_t;
+
+    std::vector<std::pair<filter_t, topic_t>> matching_subscriptions = {
+            {"a/b/c", "a/b/c"},
+            {"+/b/c", "a/b/c"},
+            {"a/+/c", "a/b/c"},
+            {"a/b/+", "a/b/c"},
+            {"a/#", "a/b/c"},
+            {"#", "a/b/c"},
+            {"+/b/#", "a/b/c"},
+            {"+/+/+", "a/b/c"},
+            {"a/#", "a"},
+            {"a/+/c", "a//c"},
+            {"$SYS/#", "$SYS/a"},
+    };
+
+    for (auto subscription : matching_subscriptions) {
+        SubscriptionIndex index;
+        index.insert(session1, Subscription{subscription.first, QoSType::QoS0});
+        ASSERT_EQ(count_matches(index, subscription.second, session1), static_cast<size_t>(1));
+    }
+
+}
+
+TEST(subscription_index, non_matching_filter_names) {
+
+    typedef std::string filter_t;
+    typedef std::string topic_t;
+
+    std::vector<std::pair<filter_t, topic_t>> non_matching_subscriptions = {
+            {"a/b/", "a/b/c"},
+            {"+/b/", "a/b/c"},
+            {"a//c", "a/b/c"},
+            {"a/b/+/", "a/b/c"},
+            {"/#",   "a/b/c"},
+            {"",     "a/b/c"},
+            {"+//#", "a/b/c"},
+            {"+//+", "a/b/c"},
+            {"#",    "$SYS/a"},
+            {"+/a",  "$SYS/a"},
+    };
+
+    for (auto subscription : non_matching_subscriptions) {
+        SubscriptionIndex index;
+        index.insert(session1, Subscription{subscription.first, QoSType::QoS0});
+        ASSERT_EQ(count_matches(index, subscription.second, session1), static_cast<size_t>(0));
+    }
+
+}
+
+TEST(subscription_index, replace_and_erase) {
+
+    SubscriptionIndex index;
+
+    index.insert(session1, Subscription{TopicFilter("a/+/c"), QoSType::QoS0});
+    index.insert(session1, Subscription{TopicFilter("a/+/c"), QoSType::QoS2});
+    index.insert(session2, Subscription{TopicFilter("a/#"), QoSType::QoS1});
+    ASSERT_EQ(index.size(), static_cast<size_t>(2));
+
+    std::vector<Subscriber> subscribers;
+    index.match(TopicName("a/b/c"), subscribers);
+    ASSERT_EQ(subscribers.size(), static_cast<size_t>(2));
+    for (auto &subscriber : subscribers) {
+        ASSERT_EQ(subscriber.qos, subscriber.session == session1 ? QoSType::QoS2 : QoSType::QoS1);
+    }
+
+    ASSERT_FALSE(index.erase(session2, TopicFilter("a/+/c")));
+    ASSERT_TRUE(index.erase(session1, TopicFilter("a/+/c")));
+    ASSERT_FALSE(index.erase(session1, TopicFilter("a/+/c")));
+    ASSERT_EQ(count_matches(index, "a/b/c", session1), static_cast<size_t>(0));
+    ASSERT_EQ(count_matches(index, "a/b/c", session2), static_cast<size_t>(1));
+
+    ASSERT_TRUE(index.erase(session2, TopicFilter("a/#")));
+    ASSERT_EQ(index.size(), static_cast<size_t>(0));
+}
+
+TEST(subscription_index, exact_and_wildcard_filters) {
+
+    SubscriptionIndex index;
+
+    index.insert(session1, Subscription{TopicFilter("a/b/c"), QoSType::QoS0});
+    index.insert(session2, Subscription{TopicFilter("a/b/c"), QoSType::QoS0});
+    index.insert(session2, Subscription{TopicFilter("a/+/c"), QoSType::QoS0});
+    ASSERT_EQ(index.size(), static_cast<size_t>(3));
+
+    ASSERT_EQ(count_matches(index, "a/b/c", session1), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "a/b/c", session2), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "a/x/c", session1), static_cast<size_t>(0));
+    ASSERT_EQ(count_matches(index, "a/x/c", session2), static_cast<size_t>(1));
+
+    ASSERT_TRUE(index.erase(session1, TopicFilter("a/b/c")));
+    ASSERT_EQ(count_matches(index, "a/b/c", session1), static_cast<size_t>(0));
+    ASSERT_EQ(count_matches(index, "a/b/c", session2), static_cast<size_t>(1));
+    ASSERT_EQ(index.size(), static_cast<size_t>(2));
+}
+
+TEST(subscription_index, overlapping_filters_match_once) {
+
+    SubscriptionIndex index;
+
+    index.insert(session1, Subscription{TopicFilter("a/#"), QoSType::QoS0});
+    index.insert(session1, Subscription{TopicFilter("a/+/c"), QoSType::QoS2});
+    index.insert(session1, Subscription{TopicFilter("a/b/c"), QoSType::QoS1});
+    index.insert(session2, Subscription{TopicFilter("#"), QoSType::QoS1});
+    index.insert(session2, Subscription{TopicFilter("+/b/#"), QoSType::QoS0});
+
+    std::vector<Subscriber> subscribers;
+    index.match(TopicName("a/b/c"), subscribers);
+    ASSERT_EQ(subscribers.size(), static_cast<size_t>(2));
+    for (auto &subscriber : subscribers) {
+        ASSERT_EQ(subscriber.qos, subscriber.session == session1 ? QoSType::QoS2 : QoSType::QoS1);
+    }
+
+    subscribers.clear();
+    index.match(TopicName("a/x"), subscribers);
+    ASSERT_EQ(subscribers.size(), static_cast<size_t>(2));
+    for (auto &subscriber : subscribers) {
+        ASSERT_EQ(subscriber.qos, subscriber.session == session1 ? QoSType::QoS0 : QoSType::QoS1);
+    }
+}
+
+TEST(subscription_index, system_topics) {
+
+    SubscriptionIndex index;
+
+    index.insert(session1, Subscription{TopicFilter("#"), QoSType::QoS0});
+    index.insert(session1, Subscription{TopicFilter("+/broker/#"), QoSType::QoS0});
+    index.insert(session2, Subscription{TopicFilter("$SYS/#"), QoSType::QoS0});
+    index.insert(session2, Subscription{TopicFilter("$SYS/+/load"), QoSType::QoS0});
+
+    ASSERT_EQ(count_matches(index, "$SYS/broker/load", session1), static_cast<size_t>(0));
+    ASSERT_EQ(count_matches(index, "$SYS/broker/load", session2), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "SYS/broker/load", session1), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "SYS/broker/load", session2), static_cast<size_t>(0));
+
+    ASSERT_TRUE(index.erase(session2, TopicFilter("$SYS/#")));
+    ASSERT_EQ(count_matches(index, "$SYS/broker/load", session2), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "$SYS/broker", session2), static_cast<size_t>(0));
+}
+
+TEST(subscription_index, path_compression) {
+
+    SubscriptionIndex index;
+    ASSERT_EQ(index.node_count(), static_cast<size_t>(2));
+
+    index.insert(session1, Subscription{TopicFilter("a/b/c/d/+"), QoSType::QoS0});
+    ASSERT_EQ(index.node_count(), static_cast<size_t>(4));
+
+    // Branching part way along a compressed run splits it
+    index.insert(session1, Subscription{TopicFilter("a/b/x/+"), QoSType::QoS0});
+    ASSERT_EQ(index.node_count(), static_cast<size_t>(7));
+    ASSERT_EQ(count_matches(index, "a/b/c/d/e", session1), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "a/b/x/e", session1), static_cast<size_t>(1));
+    ASSERT_EQ(count_matches(index, "a/b/c/e", session1), static_cast<size_t>(0));
+    ASSERT_EQ(count_matches(index, "a/b", session1), static_cast<size_t>(0));
+
+    // Removing the branch merges the run again
+    ASSERT_TRUE(index.erase(session1, TopicFilter("a/b/x/+")));
+    ASSERT_EQ(index.node_count(), static_cast<size_t>(4));
+    ASSERT_EQ(count_matches(index, "a/b/c/d/e", session1), static_cast<size_t>(1));
+
+    ASSERT_TRUE(index.erase(session1, TopicFilter("a/b/c/d/+")));
+    ASSERT_EQ(index.node_count(), static_cast<size_t>(2));
+}
+
+TEST(subscription_index, compaction_after_churn) {
+
+    SubscriptionIndex index;
+
+    for (int i = 0; i < 2000; i++) {
+        index.insert(session1, Subscription{TopicFilter("x/" + std::to_string(i) + "/+"), QoSType::QoS0});
+    }
+    size_t peak_bytes = index.bytes_used();
+
+    for (int i = 0; i < 2000; i++) {
+        if (i % 100 != 0) {
+            ASSERT_TRUE(index.erase(session1, TopicFilter("x/" + std::to_string(i) + "/+")));
+        }
+    }
+
+    ASSERT_EQ(index.size(), static_cast<size_t>(20));
+    ASSERT_LT(index.bytes_used() * 4, peak_bytes);
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_EQ(count_matches(index, "x/" + std::to_string(i) + "/y", session1), i % 100 == 0 ? 1u : 0u);
+    }
+}
+
+TEST(subscription_index, churn_agrees_with_topic_match) {
+
+    const std::vector<std::string> levels = {"a", "b", "c", "d", "e", "f", "g", "+", "#"};
+    const std::vector<BrokerSession *> sessions = {session1, session2};
+
+    std::mt19937 random(1);
+
+    auto random_topic = [&](size_t choices) {
+        std::string topic;
+        size_t count = 1 + random() % 4;
+        for (size_t i = 0; i < count; i++) {
+            topic += (i ? "/" : "") + levels[random() % choices];
+        }
+        return topic;
+    };
+
+    SubscriptionIndex index;
+    std::set<std::pair<BrokerSession *, std::string>> subscribed;
+
+    for (int i = 0; i < 20000; i++) {
+
+        std::string filter = random_topic(levels.size());
+        if (!TopicFilter("a").is_valid(filter)) {
+            continue;
+        }
+        BrokerSession *session = sessions[random() % sessions.size()];
+
+        if (random() % 2) {
+            index.insert(session, Subscription{TopicFilter(filter), QoSType::QoS0});
+            subscribed.insert(std::make_pair(session, filter));
+        } else {
+            ASSERT_EQ(index.erase(session, TopicFilter(filter)), subscribed.erase(std::make_pair(session, filter)) == 1);
+        }
+        ASSERT_EQ(index.size(), subscribed.size());
+
+        if (i % 10 == 0) {
+            TopicName name(random_topic(levels.size() - 2));
+            for (auto session : sessions) {
+                bool expected = std::any_of(subscribed.begin(), subscribed.end(),
+                                            [&](const std::pair<BrokerSession *, std::string> &s) {
+                                                return s.first == session and topic_match(TopicFilter(s.second), name);
+                                            });
+                ASSERT_EQ(count_matches(index, name, session), expected ? 1u : 0u) << std::string(name);
+                if (expected) {
+                    ASSERT_TRUE(index.may_match(name)) << std::string(name);
+                }
+            }
+        }
+    }
+
+    for (auto &s : subscribed) {
+        ASSERT_TRUE(index.erase(s.first, TopicFilter(s.second)));
+    }
+    ASSERT_EQ(index.node_count(), static_cast<size_t>(2));
+}
+
+TEST(routing_filter, rejects_unsubscribed_prefixes) {
+
+    RoutingFilter filter;
+    ASSERT_FALSE(filter.may_match("a/b/c"));
+
+    filter.insert(TopicFilter("devices/+/status"));
+    filter.insert(TopicFilter("alerts/fire/#"));
+    filter.insert(TopicFilter("$SYS/broker"));
+
+    ASSERT_TRUE(filter.may_match("devices/d1/status"));
+    ASSERT_TRUE(filter.may_match("alerts/fire"));
+    ASSERT_TRUE(filter.may_match("alerts/fire/zone1"));
+    ASSERT_TRUE(filter.may_match("$SYS/broker"));
+    ASSERT_FALSE(filter.may_match("alerts/flood/zone1"));
+    ASSERT_FALSE(filter.may_match("alerts"));
+    ASSERT_FALSE(filter.may_match("telemetry/d1"));
+    ASSERT_FALSE(filter.may_match("$SYS/clients"));
+
+    // A leading wildcard can match anything except $ topics
+    filter.insert(TopicFilter("+/d1"));
+    ASSERT_TRUE(filter.may_match("telemetry/d1"));
+    ASSERT_FALSE(filter.may_match("$SYS/clients"));
+
+    filter.erase(TopicFilter("+/d1"));
+    filter.erase(TopicFilter("alerts/fire/#"));
+    ASSERT_FALSE(filter.may_match("telemetry/d1"));
+    ASSERT_FALSE(filter.may_match("alerts/fire/zone1"));
+    ASSERT_TRUE(filter.may_match("devices/d1/status"));
+}
+
+TEST(subscription_set, replace_and_erase) {
+
+    SubscriptionSet subscriptions;
+
+    ASSERT_TRUE(subscriptions.insert(Subscription{TopicFilter("a/+/c"), QoSType::QoS0}));
+    ASSERT_TRUE(subscriptions.insert(Subscription{TopicFilter("a/#"), QoSType::QoS1}));
+    ASSERT_TRUE(subscriptions.insert(Subscription{TopicFilter("b"), QoSType::QoS2}));
+    ASSERT_FALSE(subscriptions.insert(Subscription{TopicFilter("a/#"), QoSType::QoS1}));
+    ASSERT_TRUE(subscriptions.insert(Subscription{TopicFilter("a/+/c"), QoSType::QoS2}));
+    ASSERT_EQ(subscriptions.size(), static_cast<size_t>(3));
+    ASSERT_EQ(subscriptions.find(TopicFilter("a/+/c"))->qos, QoSType::QoS2);
+
+    ASSERT_TRUE(subscriptions.erase(TopicFilter("a/+/c")));
+    ASSERT_FALSE(subscriptions.erase(TopicFilter("a/+/c")));
+    ASSERT_EQ(subscriptions.find(TopicFilter("a/+/c")), nullptr);
+    ASSERT_EQ(subscriptions.find(TopicFilter("b"))->qos, QoSType::QoS2);
+    ASSERT_EQ(subscriptions.find(TopicFilter("a/#"))->qos, QoSType::QoS1);
+
+    size_t count = 0;
+    for (auto &subscription : subscriptions) {
+        ASSERT_EQ(subscriptions.find(subscription.topic_filter), &subscription);
+        count++;
+    }
+    ASSERT_EQ(count, static_cast<size_t>(2));
+
+    ASSERT_TRUE(subscriptions.erase(TopicFilter("b")));
+    ASSERT_TRUE(subscriptions.erase(TopicFilter("a/#")));
+    ASSERT_TRUE(subscriptions.empty());
+}
+
+TEST(shared_subscriptions, parse_shared_filters) {
+
+    SharedFilter shared_filter(TopicFilter("$share/workers/ingest/#"));
+    ASSERT_EQ(shared_filter.group, "workers");
+    ASSERT_TRUE(topic_match(shared_filter.topic_filter, TopicFilter("ingest/#")));
+
+    ASSERT_FALSE(SharedFilter::is_shared(TopicFilter("ingest/#")));
+    ASSERT_FALSE(SharedFilter::is_shared(TopicFilter("$share")));
+
+    for (auto filter : {"$share/workers", "$share//ingest", "$share/+/ingest", "$share/#", "$share/workers/"}) {
+        ASSERT_TRUE(SharedFilter::is_shared(TopicFilter(filter)));
+        ASSERT_FALSE(SharedFilter::is_valid(TopicFilter(filter)));
+        ASSERT_THROW(SharedFilter f{TopicFilter(filter)}, std::exception);
+    }
+}
+
+TEST(shared_subscriptions, one_delivery_per_group) {
+
+    SubscriptionIndex index;
+
+    index.insert(session1, Subscription{TopicFilter("$share/workers/ingest/#"), QoSType::QoS1});
+    index.insert(session2, Subscription{TopicFilter("$share/workers/ingest/#"), QoSType::QoS1});
+    index.insert(session2, Subscription{TopicFilter("ingest/#"), QoSType::QoS0});
+    ASSERT_EQ(index.size(), static_cast<size_t>(3));
+
+    std::vector<Subscriber> subscribers;
+    index.match(TopicName("ingest/a"), subscribers);
+    ASSERT_EQ(subscribers.size(), static_cast<size_t>(2));
+    ASSERT_EQ(count_matches(index, "ingest/a", session1), static_cast<size_t>(0));
+    ASSERT_EQ(count_matches(index, "ingest/a", session2), static_cast<size_t>(1));
+
+    auto shared = std::find_if(subscribers.begin(), subscribers.end(), [](const Subscriber &s) { return s.group; });
+    ASSERT_NE(shared, subscribers.end());
+    SharedGroup &group = *shared->group;
+    ASSERT_EQ(group.members.size(), static_cast<size_t>(2));
+
+    // Round robin alternates between members
+    BrokerSession *first = group.select("ingest/a", ShareStrategy::RoundRobin).session;
+    BrokerSession *second = group.select("ingest/a", ShareStrategy::RoundRobin).session;
+    ASSERT_NE(first, second);
+    ASSERT_EQ(group.select("ingest/a", ShareStrategy::RoundRobin).session, first);
+
+    // Sticky selection keeps a topic name on one member
+    BrokerSession *sticky = group.select("ingest/b", ShareStrategy::StickyTopic).session;
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(group.select("ingest/b", ShareStrategy::StickyTopic).session, sticky);
+    }
+
+    ASSERT_TRUE(index.erase(session1, TopicFilter("$share/workers/ingest/#")));
+    ASSERT_FALSE(index.erase(session1, TopicFilter("$share/workers/ingest/#")));
+    ASSERT_TRUE(index.erase(session2, TopicFilter("$share/workers/ingest/#")));
+
+    subscribers.clear();
+    index.match(TopicName("ingest/a"), subscribers);
+    ASSERT_EQ(subscribers.size(), static_cast<size_t>(1));
+    ASSERT_EQ(subscribers[0].session, session2);
+    ASSERT_EQ(index.size(), static_cast<size_t>(1));
+}
+
+TEST(shared_subscriptions, least_inflight_member) {
+
+    struct event_base *evloop = event_base_new();
+    ASSERT_NE(evloop, nullptr);
+
+    {
+        SessionManager session_manager;
+        BrokerSession busy(bufferevent_socket_new(evloop, -1, 0), session_manager);
+        BrokerSession idle(bufferevent_socket_new(evloop, -1, 0), session_manager);
+
+        PublishPacket packet;
+        packet.message = std::make_shared<Message>("ingest/a", std::vector<uint8_t>());
+        busy.forward_packet(packet, QoSType::QoS1);
+
+        SharedGroup group(TopicFilter("$share/workers/ingest/#").interned());
+        group.insert(&busy, QoSType::QoS1);
+        group.insert(&idle, QoSType::QoS1);
+
+        for (int i = 0; i < 4; i++) {
+            ASSERT_EQ(group.select("ingest/a", ShareStrategy::LeastInflight).session, &idle);
+        }
+
+        // Members with the same depth take turns
+        PubackPacket puback;
+        puback.packet_id = busy.qos1_pending_puback[0].packet_id;
+        busy.handle_puback(puback);
+        ASSERT_NE(group.select("ingest/a", ShareStrategy::LeastInflight).session,
+                  group.select("ingest/a", ShareStrategy::LeastInflight).session);
+    }
+
+    event_base_free(evloop);
+}
+
+TEST(routing_cache, hits_misses_and_invalidation) {
+
+    RoutingCache cache(2);
+
+    std::vector<Subscriber> subscribers = {{session1, QoSType::QoS1}};
+
+    ASSERT_EQ(cache.find("a/b/c"), nullptr);
+    cache.insert("a/b/c", subscribers);
+    ASSERT_NE(cache.find("a/b/c"), nullptr);
+    ASSERT_EQ(cache.find("a/b/c")->size(), static_cast<size_t>(1));
+
+    cache.invalidate();
+    ASSERT_EQ(cache.find("a/b/c"), nullptr);
+
+    cache.insert("a", subscribers);
+    cache.insert("b", subscribers);
+    ASSERT_NE(cache.find("a"), nullptr);
+    cache.insert("c", subscribers);
+    ASSERT_EQ(cache.size(), static_cast<size_t>(2));
+    ASSERT_NE(cache.find("a"), nullptr);
+    ASSERT_EQ(cache.find("b"), nullptr);
+
+    ASSERT_EQ(cache.hits(), static_cast<uint64_t>(4));
+    ASSERT_EQ(cache.misses(), static_cast<uint64_t>(3));
+}
@@ -5,6 +5,8 @@
 #include "gtest/gtest.h"
 
 #include "topic.h"
+#include "subscription_index.h"
+#include "topic_scan.h"
 
 TEST(topic_filters, valid_topic_filters) {
 
@@ -44,6 +46,80 @@ TEST(topic_filters, invalid_topic_filters) {
 
 }
 
+TEST(topic_filters, long_multi_level_filters) {
+
+    // Tens of thousands of levels, validated in one pass whether or not they contain wildcards
+    std::string levels;
+    while (levels.size() < TopicFilter::MaxFilterSize - 2) {
+        levels += "a/";
+    }
+
+    ASSERT_TRUE(TopicFilter::intern_filter(levels + "#"));
+    ASSERT_TRUE(TopicFilter::intern_filter(levels + "+"));
+    ASSERT_FALSE(TopicFilter::intern_filter(levels + "a#"));
+    ASSERT_FALSE(TopicFilter::intern_filter("#/" + levels.substr(2) + "a"));
+
+    std::string distinct;
+    for (size_t i = 0; distinct.size() < TopicFilter::MaxFilterSize - 16; i++) {
+        distinct += std::to_string(i) + "/";
+    }
+
+    TopicFilter filter(distinct + "#");
+    ASSERT_TRUE(filter.has_wildcards());
+    ASSERT_TRUE(filter.is_valid(distinct + "+"));
+    ASSERT_FALSE(filter.is_valid(distinct + "+a"));
+    ASSERT_FALSE(filter.is_valid("+a/" + distinct + "#"));
+}
+
+TEST(topic_names, malformed_topic_names) {
+
+    std::vector<std::string> malformed_names = {
+            std::string("a/\0/c", 5),
+            "a/\xc0\xaf",             // overlong '/'
+            "a/\xed\xa0\x80",         // surrogate
+            "a/\xf4\x90\x80\x80",     // beyond U+10FFFF
+            "a/\xe2\x82",             // truncated
+            "a/\x80"};
+
+    for (auto name_string : malformed_names) {
+        ASSERT_THROW(TopicName n(name_string), std::exception);
+        ASSERT_THROW(TopicFilter f(name_string), std::exception);
+        ASSERT_FALSE(TopicName::intern_name(name_string));
+    }
+
+    // Names interned for routing are checked without throwing
+    ASSERT_FALSE(TopicName::intern_name("a/+"));
+    ASSERT_FALSE(TopicName::intern_name("a/#"));
+    ASSERT_FALSE(TopicName::intern_name(std::string(TopicName::MaxNameSize + 1, 'a')));
+    ASSERT_EQ(TopicName::intern_name("a/b"), TopicName("a/b").interned());
+
+    TopicName n("caf\xc3\xa9/\xe2\x82\xac/\xf0\x9f\x98\x80");
+    ASSERT_EQ(3, n.levels().size());
+}
+
+TEST(topic_names, vector_scan_agrees_with_scalar) {
+
+    std::vector<std::string> topics = {
+            "",
+            "/",
+            "a/b/c",
+            std::string(40, 'a') + "/" + std::string(40, 'b') + "/+/" + std::string(20, 'c'),
+            std::string(31, 'a') + "/" + std::string(32, '/') + "#",
+            std::string(64, 'x') + std::string("\0", 1) + "/y",
+            std::string(33, 'x') + "\xc3\xa9/" + std::string(30, 'y'),
+            std::string(35, 'x') + "\xc3/" + std::string(30, 'y')};
+
+    for (auto &topic : topics) {
+        TopicScan vector_scan;
+        TopicScan scalar_scan;
+        scan_topic(topic, vector_scan);
+        scan_topic_scalar(topic, scalar_scan);
+        ASSERT_EQ(scalar_scan.well_formed, vector_scan.well_formed);
+        ASSERT_EQ(scalar_scan.wildcards, vector_scan.wildcards);
+        ASSERT_EQ(scalar_scan.separators, vector_scan.separators);
+    }
+}
+
 TEST(subscription_matching, matching_filter_names) {
 
     typedef std::string filter_t;
@@ -92,4 +168,89 @@ TEST(subscription_matching, non_matching_filter_names) {
         ASSERT_FALSE(topic_match(f, n));
     }
 
-}
\ No newline at end of file
+}
+TEST(interned_topics, shared_ids_and_levels) {
+
+    TopicFilter f1("a/+/c");
+    TopicFilter f2("a/+/c");
+    TopicName n1("a/b/c");
+    TopicFilter f3("a/b/c");
+
+    ASSERT_EQ(f1.id(), f2.id());
+    ASSERT_EQ(f1.interned(), f2.interned());
+    ASSERT_EQ(n1.id(), f3.id());
+    ASSERT_NE(f1.id(), n1.id());
+
+    ASSERT_EQ(f1.levels().size(), static_cast<size_t>(3));
+    ASSERT_EQ(f1.levels()[0].id, n1.levels()[0].id);
+    ASSERT_EQ(f1.levels()[1].id, InternedTopic::SingleLevelWildcard);
+    ASSERT_EQ(f1.levels()[2].id, n1.levels()[2].id);
+    ASSERT_NE(n1.levels()[1].id, n1.levels()[2].id);
+
+    ASSERT_EQ(n1.levels()[2].offset, 4);
+    ASSERT_EQ(n1.levels()[2].length, 1);
+
+    TopicName n2("/");
+    ASSERT_EQ(n2.levels().size(), static_cast<size_t>(2));
+    ASSERT_EQ(n2.levels()[0].id, n2.levels()[1].id);
+
+    ASSERT_EQ(TopicFilter("#").levels()[0].id, InternedTopic::MultiLevelWildcard);
+
+    ASSERT_THROW(TopicName n3("a/+/c"), std::exception);
+}
+
+/**
+ * Build every topic string of up to max_levels levels drawn from a set of level strings.
+ */
+static std::vector<std::string> generate_topics(const std::vector<std::string> &levels, size_t max_levels) {
+
+    std::vector<std::string> topics(levels);
+    std::vector<std::string> previous(levels);
+
+    for (size_t i = 1; i < max_levels; i++) {
+        std::vector<std::string> next;
+        for (auto &prefix : previous) {
+            for (auto &level : levels) {
+                next.push_back(prefix + "/" + level);
+            }
+        }
+        topics.insert(topics.end(), next.begin(), next.end());
+        previous = next;
+    }
+
+    return topics;
+}
+
+TEST(subscription_matching, compiled_matcher_agrees_with_index) {
+
+    std::vector<std::string> filters;
+    for (auto &f : generate_topics({"a", "b", "", "+", "#", "$a"}, 3)) {
+        try {
+            TopicFilter topic_filter(f);
+            filters.push_back(f);
+        } catch (std::exception &) {
+            // skip invalid filters
+        }
+    }
+
+    std::vector<std::string> names = generate_topics({"a", "b", "", "$a"}, 3);
+
+    BrokerSession *session = reinterpret_cast<BrokerSession *>(0x10);
+
+    for (auto &filter_string : filters) {
+        TopicFilter f(filter_string);
+
+        SubscriptionIndex index;
+        index.insert(session, Subscription{f, QoSType::QoS0});
+
+        for (auto &name_string : names) {
+            TopicName n(name_string);
+
+            std::vector<Subscriber> subscribers;
+            index.match(n, subscribers);
+
+            ASSERT_EQ(topic_match(f, n), !subscribers.empty()) << filter_string << " " << name_string;
+        }
+    }
+
+}